@@ -0,0 +1,798 @@
+/*
+ * MIT/X Consortium License, see LICENSE.
+ *
+ * sxlock-bench - runs the lock screen effect on synthetic and recorded frames
+ * without touching the display, and reports how fast every stage is.
+ */
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <math.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <getopt.h>     // getopt_long()
+#include <sys/resource.h>   // getrusage()
+
+#include "effect.h"
+#include "pool.h"
+#include "trace.h"
+#include "ziggurat_inline.h"
+
+#define MAX_FRAMES 16
+
+typedef struct Frame {
+    char name[64];
+    int width, height;
+    uint32_t *data;     // BGRA, like the captured screen
+} Frame;
+
+typedef struct Result {
+    char name[64];
+    int width, height;
+    double drift_us, stage_us[3], wall_us;
+    long peak_rss_kb;
+} Result;
+
+static const struct {
+    const char *name;
+    int width, height;
+} sizes[] = {
+    { "1080p", 1920, 1080 },
+    { "4k",    3840, 2160 },
+    { "8k",    7680, 4320 },
+};
+
+static const char *stage_names[3] = { "stage1", "stage2", "stage3" };
+
+/* all timings use the same seed, so every run does the same work */
+#define BENCH_SEED 1
+
+/* Hashes of the reference output, the scalar stages on the calling thread,
+ * for synthetic frames. They only change when the effect is changed on
+ * purpose; --verify prints the new hash of every case that fails. */
+static const struct {
+    int width, height;
+    uint32_t seed;
+    uint64_t hash;
+} golden[] = {
+    {   97,   61,          1, 0x9da9e24946d13b87ull },
+    {  640,  480,          1, 0x3d22318f9aec53f9ull },
+    { 1920, 1080, 0xdeadbeef, 0x4afe4e654c07b503ull },
+    /* the strips of the animation, and frames narrower than the offsets */
+    { 1920,   16,          7, 0x41080875cc2190ceull },
+    { 1920,   32,          7, 0xb3d01ca3831c7b9bull },
+    { 3840,   16,          7, 0x8b3350c9728ca9f6ull },
+    {    7,    5,          3, 0x442a04f3cf258fddull },
+    {    1,    1,          3, 0x5280d5d9028d85e5ull },
+    {    3,  200,          3, 0x722b9e8300ddb15eull },
+};
+
+/* Known answers of Philox4x32-10, from the kat_vectors of Random123 */
+static const struct {
+    uint32_t ctr[4], key[2], out[4];
+} philox_kat[] = {
+    { { 0x00000000, 0x00000000, 0x00000000, 0x00000000 }, { 0x00000000, 0x00000000 },
+      { 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 } },
+    { { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff }, { 0xffffffff, 0xffffffff },
+      { 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd } },
+    { { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 }, { 0xa4093822, 0x299f31d0 },
+      { 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 } },
+};
+
+/* Hashes of 100000 variates the original ziggurat code drew from these
+ * states, set with zigset(): normal and exponential ones by turns */
+static const struct {
+    zig_state state;
+    uint64_t hash;
+} zig_kat[] = {
+    { { 123456789, 234567891, 345678912, 456789123 }, 0xd796ccaeb92ea232ull },
+    { { 0xdeadbeef, 7, 99, 12345 },                   0x3642c1d99968fe38ull },
+};
+#define ZIG_KAT_COUNT 100000
+
+/* the first words zig_kiss() returns after zig_seed(1) */
+static const uint32_t zig_seed_kat[4] = { 0x06034b7f, 0x8049441e, 0x5c238095, 0x5119a0df };
+
+/* Every variant is checked against the reference on the golden frames. A
+ * variant may differ by up to max_diff in any channel of any pixel, and by
+ * more in at most the share max_share of the pixels. Field variants make a
+ * displacement field first and apply that, frames variants corrupt that many
+ * copies of the frame at once with corrupt_frames().
+ *
+ * The fixed point stages round differently from the floating point ones, so
+ * a few pixels differ. On the golden frames that is at most 0.028% of them
+ * (1920x1080), so 0.1% leaves a margin of about 3x and still catches an
+ * engine that is wrong anywhere else. */
+#define MAX_COPIES 3
+static const struct {
+    const char *name;
+    EffectImpl impl;
+    int fixed;
+    int field;
+    int frames;
+    int threads;
+    int max_diff;
+    double max_share;
+} variants[] = {
+    { "scalar, 2 threads",         EFFECT_SCALAR, 0, 0, 0, 2, 0, 0.0 },
+    { "scalar, 3 threads",         EFFECT_SCALAR, 0, 0, 0, 3, 0, 0.0 },
+    { "scalar, 8 threads",         EFFECT_SCALAR, 0, 0, 0, 8, 0, 0.0 },
+    { "sse2",                      EFFECT_SSE2,   0, 0, 0, 1, 0, 0.0 },
+    { "avx2",                      EFFECT_AVX2,   0, 0, 0, 1, 0, 0.0 },
+    { "avx2, 3 threads",           EFFECT_AVX2,   0, 0, 0, 3, 0, 0.0 },
+    { "field",                     EFFECT_SCALAR, 0, 1, 0, 1, 0, 0.0 },
+    { "avx2, field, 3 threads",    EFFECT_AVX2,   0, 1, 0, 3, 0, 0.0 },
+    { "avx2, 3 frames, 3 threads", EFFECT_AVX2,   0, 0, 3, 3, 0, 0.0 },
+    { "fixed",                     EFFECT_SCALAR, 1, 0, 0, 1, 0, 0.001 },
+    { "avx2, fixed",               EFFECT_AVX2,   1, 0, 0, 1, 0, 0.001 },
+};
+
+static int opt_threads;
+static int opt_iterations = 5;
+static char* opt_sizes = "1080p,4k,8k";
+static char* opt_images[MAX_FRAMES];
+static int opt_nimages;
+static char* opt_output;
+static char* opt_baseline;
+static double opt_tolerance = 10.0;
+static char* opt_trace;
+static int opt_verify;
+static EffectImpl opt_impl = EFFECT_AUTO;
+static int opt_fixed;
+
+static void
+die(const char *errstr, ...) {
+    va_list ap;
+
+    va_start(ap, errstr);
+    vfprintf(stderr, errstr, ap);
+    va_end(ap);
+    trace_close();
+    exit(EXIT_FAILURE);
+}
+
+/* something that looks a bit like a desktop: a gradient with a few flat
+ * windows and noisy "text" rows, so all the stages see varied input */
+static void
+frame_synthetic(Frame *f, const char *name, int width, int height) {
+    uint32_t r = 0x9e3779b9;
+
+    snprintf(f->name, sizeof(f->name), "%s", name);
+    f->width = width;
+    f->height = height;
+    if (!(f->data = malloc(4 * (size_t)width * height)))
+        die("out of memory\n");
+
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint32_t *p = &f->data[(size_t)y * width + x];
+            int wx = width >= 4 ? x / (width / 4) : x, wy = height >= 3 ? y / (height / 3) : y;
+
+            r ^= r << 13;
+            r ^= r >> 17;
+            r ^= r << 5;
+
+            if ((wx + wy) % 3 == 0) {
+                *p = 0xff202428;
+                if ((y / 12) % 2 && (r & 3))
+                    *p = 0xffd0d0d0;
+            } else {
+                uint32_t b = 255 * x / width, g = 255 * y / height;
+                *p = 0xff000000 | (r & 0x000f0000) | g << 8 | b;
+            }
+        }
+    }
+}
+
+static void
+frame_load(Frame *f, const char *path) {
+    int n;
+    const char *base = strrchr(path, '/');
+    unsigned char *img = stbi_load(path, &f->width, &f->height, &n, 4);
+
+    if (!img)
+        die("%s: %s\n", path, stbi_failure_reason());
+    snprintf(f->name, sizeof(f->name), "%s", base ? base + 1 : path);
+
+    /* stb_image gives RGBA, the effect wants BGRA */
+    f->data = malloc(4 * (size_t)f->width * f->height);
+    if (!f->data)
+        die("out of memory\n");
+    for (size_t i = 0; i < (size_t)f->width * f->height; i++)
+        f->data[i] = (uint32_t)img[4*i+3] << 24 | (uint32_t)img[4*i+0] << 16 |
+                     (uint32_t)img[4*i+1] << 8 | img[4*i+2];
+    stbi_image_free(img);
+}
+
+/* set once resetting the peak RSS failed, it is then the peak of the whole
+ * run so far and labelled as such */
+static int rss_cumulative;
+
+/* Linux resets the peak RSS of the process when "5" is written to
+ * clear_refs, so every frame gets a peak of its own. */
+static void
+peak_rss_reset(void) {
+    FILE *f = fopen("/proc/self/clear_refs", "w");
+
+    if (!f || fputs("5", f) < 0)
+        rss_cumulative = 1;
+    if (f && fclose(f) != 0)
+        rss_cumulative = 1;
+}
+
+static long
+peak_rss_kb(void) {
+    FILE *f = fopen("/proc/self/status", "r");
+    char line[256];
+    long kb = -1;
+
+    while (f && fgets(line, sizeof(line), f))
+        if (sscanf(line, "VmHWM: %ld", &kb) == 1)
+            break;
+    if (f)
+        fclose(f);
+    if (kb < 0) {
+        struct rusage ru;
+        kb = getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : 0;
+    }
+    return kb;
+}
+
+/* runs the effect on a copy of the frame; every stage reports its fastest
+ * iteration, which is the least disturbed by the rest of the system. The
+ * peak RSS must have been reset before the frame was made. */
+static void
+run(const Frame *f, Pool *pool, Result *res) {
+    size_t size = 4 * (size_t)f->width * f->height;
+    uint32_t *work = malloc(size);
+
+    if (!work)
+        die("out of memory\n");
+
+    snprintf(res->name, sizeof(res->name), "%s", f->name);
+    res->width = f->width;
+    res->height = f->height;
+
+    /* warm up caches and the allocator first */
+    memcpy(work, f->data, size);
+    corrupt_it(work, f->width, f->height, BENCH_SEED, pool, NULL);
+
+    for (int i = 0; i < opt_iterations; i++) {
+        EffectTimes t;
+
+        memcpy(work, f->data, size);
+        uint64_t start = trace_now();
+        corrupt_it(work, f->width, f->height, BENCH_SEED, pool, &t);
+        double wall = trace_now() - start;
+
+        if (i == 0 || t.drift < res->drift_us)
+            res->drift_us = t.drift;
+        for (int s = 0; s < 3; s++)
+            if (i == 0 || t.stage[s] < res->stage_us[s])
+                res->stage_us[s] = t.stage[s];
+        if (i == 0 || wall < res->wall_us)
+            res->wall_us = wall;
+    }
+
+    res->peak_rss_kb = peak_rss_kb();
+    free(work);
+}
+
+static double
+mpix_s(const Result *res, double us) {
+    return us > 0 ? (double)res->width * res->height / us : 0.0;
+}
+
+/* one result per line, so that the baseline can be read back with sscanf */
+static void
+write_json(FILE *f, const Result *results, int count, int threads) {
+    fprintf(f, "{\"kernels\":\"%s\",\"fixed\":%s,\"threads\":%d,\"iterations\":%d,\"peak_rss\":\"%s\",\"results\":[\n",
+            effect_impl_name(effect_get_impl()), effect_get_fixed() ? "true" : "false",
+            threads, opt_iterations, rss_cumulative ? "cumulative" : "per frame");
+    for (int i = 0; i < count; i++) {
+        const Result *r = &results[i];
+        fprintf(f, "{\"name\":\"%s\",\"width\":%d,\"height\":%d,\"wall_us\":%.0f,\"total_mpix_s\":%.2f",
+                r->name, r->width, r->height, r->wall_us, mpix_s(r, r->wall_us));
+        fprintf(f, ",\"drift_us\":%.0f", r->drift_us);
+        for (int s = 0; s < 3; s++)
+            fprintf(f, ",\"%s_us\":%.0f,\"%s_mpix_s\":%.2f",
+                    stage_names[s], r->stage_us[s], stage_names[s], mpix_s(r, r->stage_us[s]));
+        fprintf(f, ",\"peak_rss_kb\":%ld}%s\n", r->peak_rss_kb, i + 1 < count ? "," : "");
+    }
+    fprintf(f, "]}\n");
+}
+
+static void
+print_table(const Result *results, int count, int threads) {
+    fprintf(stderr, "%s kernels%s, %d thread(s), best of %d\n",
+            effect_impl_name(effect_get_impl()), effect_get_fixed() ? ", fixed-point" : "",
+            threads, opt_iterations);
+    fprintf(stderr, "%-16s %11s %9s %9s %9s %9s %10s\n",
+            "frame", "size", "stage1", "stage2", "stage3", "total", rss_cumulative ? "max rss" : "rss");
+    for (int i = 0; i < count; i++) {
+        const Result *r = &results[i];
+        char size[24];
+
+        snprintf(size, sizeof(size), "%dx%d", r->width, r->height);
+        fprintf(stderr, "%-16s %11s %9.1f %9.1f %9.1f %9.1f %7ld MB\n",
+                r->name, size,
+                mpix_s(r, r->stage_us[0]), mpix_s(r, r->stage_us[1]),
+                mpix_s(r, r->stage_us[2]), mpix_s(r, r->wall_us),
+                r->peak_rss_kb / 1024);
+    }
+    fprintf(stderr, "(stages and total in megapixels/s%s)\n",
+            rss_cumulative ? ", rss is the peak of all frames so far" : "");
+}
+
+/* Reports a regression if now is worse than base by more than the
+ * tolerance; more is worse for memory, less for throughput. */
+static int
+regressed(const char *name, const char *what, double base, double now, int more_is_worse, const char *unit) {
+    if (base <= 0)
+        return 0;
+
+    double change = 100.0 * (now - base) / base;
+    if ((more_is_worse ? change : -change) <= opt_tolerance)
+        return 0;
+    fprintf(stderr, "REGRESSION %s %s: %.1f -> %.1f %s (%+.1f%%)\n", name, what, base, now, unit, change);
+    return 1;
+}
+
+/* Compares the throughput of every stage and of the whole frame, and the
+ * peak RSS, of every frame that also appears in the baseline. Returns the
+ * number of regressions beyond the tolerance. A baseline of other kernels,
+ * engine or thread count can't be compared, nor one without any of the
+ * frames of this run. */
+static int
+compare_baseline(const char *path, const Result *results, int count, int threads) {
+    FILE *f = fopen(path, "r");
+    char line[1024];
+    int regressions = 0, matches = 0;
+
+    if (!f)
+        die("%s: cannot open baseline\n", path);
+
+    char kernels[16], fixed[8], rss[16] = "";
+    int base_threads;
+    if (!fgets(line, sizeof(line), f) ||
+        sscanf(line, "{\"kernels\":\"%15[^\"]\",\"fixed\":%7[a-z],\"threads\":%d,\"iterations\":%*d,\"peak_rss\":\"%15[^\"]\"",
+               kernels, fixed, &base_threads, rss) < 3)
+        die("%s: not a baseline of sxlock-bench\n", path);
+    if (strcmp(kernels, effect_impl_name(effect_get_impl())) ||
+        strcmp(fixed, effect_get_fixed() ? "true" : "false") || base_threads != threads)
+        die("%s: recorded with %s kernels%s and %d thread(s), run with the same -k, -x and -j to compare\n",
+            path, kernels, strcmp(fixed, "true") ? "" : ", fixed-point", base_threads);
+
+    /* a peak over all frames so far can't be compared with one per frame */
+    int compare_rss = !strcmp(rss, rss_cumulative ? "cumulative" : "per frame");
+    if (!compare_rss)
+        fprintf(stderr, "%s: peak RSS was measured %s, not compared\n", path, *rss ? rss : "differently");
+
+    while (fgets(line, sizeof(line), f)) {
+        char name[64];
+        int width, height;
+        double wall, total, drift, us[3], base[3];
+        long base_rss;
+
+        if (sscanf(line, "{\"name\":\"%63[^\"]\",\"width\":%d,\"height\":%d,\"wall_us\":%lf,\"total_mpix_s\":%lf"
+                         ",\"drift_us\":%lf,\"stage1_us\":%lf,\"stage1_mpix_s\":%lf"
+                         ",\"stage2_us\":%lf,\"stage2_mpix_s\":%lf,\"stage3_us\":%lf,\"stage3_mpix_s\":%lf"
+                         ",\"peak_rss_kb\":%ld",
+                   name, &width, &height, &wall, &total, &drift,
+                   &us[0], &base[0], &us[1], &base[1], &us[2], &base[2], &base_rss) != 13)
+            continue;
+
+        for (int i = 0; i < count; i++) {
+            const Result *r = &results[i];
+
+            if (strcmp(r->name, name) || r->width != width || r->height != height)
+                continue;
+
+            matches++;
+            for (int s = 0; s < 3; s++)
+                regressions += regressed(name, stage_names[s], base[s], mpix_s(r, r->stage_us[s]), 0, "Mpix/s");
+            regressions += regressed(name, "total", total, mpix_s(r, r->wall_us), 0, "Mpix/s");
+            if (compare_rss)
+                regressions += regressed(name, "peak RSS", base_rss / 1024.0, r->peak_rss_kb / 1024.0, 1, "MB");
+        }
+    }
+
+    fclose(f);
+    if (!matches)
+        die("%s: none of the frames of this run is in the baseline\n", path);
+    return regressions;
+}
+
+/* FNV-1a */
+static uint64_t
+hash_frame(const uint32_t *data, size_t count) {
+    const unsigned char *p = (const unsigned char*)data;
+    uint64_t h = 0xcbf29ce484222325ull;
+
+    for (size_t i = 0; i < 4 * count; i++)
+        h = (h ^ p[i]) * 0x100000001b3ull;
+    return h;
+}
+
+/* the number of pixels that differ by more than max_diff in some channel */
+static size_t
+count_diff(const uint32_t *a, const uint32_t *b, size_t count, int max_diff) {
+    size_t n = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        for (int shift = 0; shift < 32; shift += 8) {
+            if (abs((int)(a[i] >> shift & 0xff) - (int)(b[i] >> shift & 0xff)) > max_diff) {
+                n++;
+                break;
+            }
+        }
+    }
+    return n;
+}
+
+/* Checks Philox against its known answers, and that r4_nor_ctr_fill() gives
+ * the same stream when it is generated piecewise. Returns the number of
+ * failed checks. */
+static int
+verify_philox(void) {
+    static float whole[1000], part[1000];
+    const uint32_t key[2] = { 0x9e3779b9, 7 };
+    int failures = 0;
+
+    for (size_t i = 0; i < sizeof(philox_kat) / sizeof(philox_kat[0]); i++) {
+        uint32_t out[4];
+
+        philox4x32(philox_kat[i].key, philox_kat[i].ctr, out);
+        if (memcmp(out, philox_kat[i].out, sizeof(out))) {
+            fprintf(stderr, "FAIL philox4x32 vector %zu: %08x %08x %08x %08x\n",
+                    i, out[0], out[1], out[2], out[3]);
+            failures++;
+        } else {
+            fprintf(stderr, "ok   philox4x32 vector %zu\n", i);
+        }
+    }
+
+    /* pieces of odd lengths that start in the middle of counters and batches */
+    r4_nor_ctr_fill(key, 3, 5, 0, whole, 1000);
+    for (int first = 0, n = 1; first < 1000; first += n, n = n * 3 + 2)
+        r4_nor_ctr_fill(key, 3, 5, first, part + first, first + n > 1000 ? 1000 - first : n);
+    if (memcmp(whole, part, sizeof(whole))) {
+        fprintf(stderr, "FAIL r4_nor_ctr_fill: the stream depends on how it is split\n");
+        failures++;
+    } else {
+        fprintf(stderr, "ok   r4_nor_ctr_fill: piecewise\n");
+    }
+
+    return failures;
+}
+
+/* the correlation of n values of a and b */
+static double
+correlation(const float *a, const float *b, int n) {
+    double sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+
+    for (int i = 0; i < n; i++) {
+        sa += a[i];
+        sb += b[i];
+        saa += (double)a[i] * a[i];
+        sbb += (double)b[i] * b[i];
+        sab += (double)a[i] * b[i];
+    }
+    return (n * sab - sa * sb) / sqrt((n * saa - sa * sa) * (n * sbb - sb * sb));
+}
+
+/* Checks the reentrant ziggurat functions: zig_nor() and zig_exp() against
+ * the original code, zig_seed() against its known answers, and that the
+ * streams of zig_split() are unrelated. Returns the number of failed checks. */
+static int
+verify_zig(void) {
+    static float values[ZIG_KAT_COUNT];
+    int failures = 0;
+
+    for (size_t i = 0; i < sizeof(zig_kat) / sizeof(zig_kat[0]); i++) {
+        const zig_state *k = &zig_kat[i].state;
+        zig_state s = *k;
+
+        for (int j = 0; j < ZIG_KAT_COUNT; j++)
+            values[j] = j & 1 ? zig_exp(&s) : zig_nor(&s);
+        uint64_t hash = hash_frame((const uint32_t*)values, ZIG_KAT_COUNT);
+
+        /* the functions without a state draw the same from the global one */
+        zigset(k->jsr, k->jcong, k->w, k->z);
+        for (int j = 0; j < ZIG_KAT_COUNT; j++)
+            values[j] = j & 1 ? r4_exp_value() : r4_nor_value();
+        uint64_t global = hash_frame((const uint32_t*)values, ZIG_KAT_COUNT);
+
+        if (hash != zig_kat[i].hash || global != zig_kat[i].hash) {
+            fprintf(stderr, "FAIL zig_nor state %zu: hash is 0x%016llxull, 0x%016llxull without a state\n",
+                    i, (unsigned long long)hash, (unsigned long long)global);
+            failures++;
+        } else {
+            fprintf(stderr, "ok   zig_nor state %zu: original variates\n", i);
+        }
+    }
+
+    zig_state a, b;
+    int same = 1;
+    zig_seed(&a, 1);
+    zig_seed(&b, 1);
+    for (int j = 0; j < 4; j++) {
+        uint32_t x = zig_kiss(&a), y = zig_kiss(&b);
+        same = same && x == zig_seed_kat[j] && y == x;
+    }
+    if (!same) {
+        fprintf(stderr, "FAIL zig_seed: the seeded state is not the known one\n");
+        failures++;
+    } else {
+        fprintf(stderr, "ok   zig_seed\n");
+    }
+
+    /* Two unrelated streams of n normals have a correlation with a standard
+     * deviation of 1/sqrt(n), 1/64 here, so 0.1 is far out of reach. */
+    enum { STREAMS = 16, DRAWS = 4096 };
+    static float streams[STREAMS][DRAWS];
+    zig_state parent, copy, t;
+    double worst = 0.0;
+    zig_seed(&parent, 7);
+    copy = parent;
+    for (int k = 0; k < STREAMS; k++) {
+        zig_split(&parent, &t, k);
+        for (int j = 0; j < DRAWS; j++)
+            streams[k][j] = zig_nor(&t);
+    }
+    for (int k = 0; k < STREAMS; k++) {
+        for (int l = k + 1; l < STREAMS; l++) {
+            double r = fabs(correlation(streams[k], streams[l], DRAWS));
+            worst = r > worst ? r : worst;
+        }
+    }
+    zig_split(&parent, &t, 3);
+    if (memcmp(&parent, &copy, sizeof(parent)) || zig_nor(&t) != streams[3][0] || !(worst < 0.1)) {
+        fprintf(stderr, "FAIL zig_split: streams are correlated by %.3f, or the split is not repeatable\n", worst);
+        failures++;
+    } else {
+        fprintf(stderr, "ok   zig_split: streams are correlated by at most %.3f\n", worst);
+    }
+
+    return failures;
+}
+
+/* Checks the reference against the golden hashes, and every variant against
+ * the reference. Returns the number of failed checks. */
+static int
+verify(void) {
+    int failures = verify_philox() + verify_zig();
+
+    for (size_t i = 0; i < sizeof(golden) / sizeof(golden[0]); i++) {
+        Frame f;
+        char name[64];
+
+        snprintf(name, sizeof(name), "%dx%d", golden[i].width, golden[i].height);
+        frame_synthetic(&f, name, golden[i].width, golden[i].height);
+
+        size_t count = (size_t)f.width * f.height;
+        uint32_t *ref = malloc(4 * count), *out = malloc(4 * count * MAX_COPIES);
+        if (!ref || !out)
+            die("out of memory\n");
+
+        effect_set_impl(EFFECT_SCALAR);
+        effect_set_fixed(0);
+        memcpy(ref, f.data, 4 * count);
+        corrupt_it(ref, f.width, f.height, golden[i].seed, NULL, NULL);
+
+        uint64_t hash = hash_frame(ref, count);
+        if (hash != golden[i].hash) {
+            fprintf(stderr, "FAIL %s seed %#x: reference hash is 0x%016llxull\n",
+                    name, golden[i].seed, (unsigned long long)hash);
+            failures++;
+        } else {
+            fprintf(stderr, "ok   %s seed %#x: reference\n", name, golden[i].seed);
+        }
+
+        for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+            if (!effect_set_impl(variants[v].impl)) {
+                fprintf(stderr, "skip %s seed %#x: %s is not supported here\n",
+                        name, golden[i].seed, variants[v].name);
+                continue;
+            }
+            effect_set_fixed(variants[v].fixed);
+            Pool *pool = pool_create(variants[v].threads);
+
+            memcpy(out, f.data, 4 * count);
+            if (variants[v].frames) {
+                EffectFrame frames[MAX_COPIES];
+                for (int j = 0; j < variants[v].frames; j++) {
+                    frames[j].data = out + j * count;
+                    frames[j].w = f.width;
+                    frames[j].h = f.height;
+                    frames[j].seed = golden[i].seed;
+                    memcpy(frames[j].data, f.data, 4 * count);
+                }
+                corrupt_frames(frames, variants[v].frames, pool);
+            } else if (variants[v].field) {
+                EffectField *field = effect_field_new(f.width, f.height, golden[i].seed, pool);
+                if (!field)
+                    die("out of memory\n");
+                effect_field_apply(field, out, pool);
+                effect_field_free(field);
+            } else {
+                corrupt_it(out, f.width, f.height, golden[i].seed, pool, NULL);
+            }
+            pool_destroy(pool);
+
+            /* every copy must match, the worst one counts */
+            double share = 0.0;
+            for (int j = 0; j < (variants[v].frames ? variants[v].frames : 1); j++) {
+                double s = (double)count_diff(ref, out + j * count, count, variants[v].max_diff) / count;
+                share = s > share ? s : share;
+            }
+            if (share > variants[v].max_share) {
+                fprintf(stderr, "FAIL %s seed %#x: %s differs by more than %d in %.2f%% of the pixels, %.2f%% allowed\n",
+                        name, golden[i].seed, variants[v].name, variants[v].max_diff,
+                        100.0 * share, 100.0 * variants[v].max_share);
+                failures++;
+            } else {
+                fprintf(stderr, "ok   %s seed %#x: %s (%.2f%% differ)\n",
+                        name, golden[i].seed, variants[v].name, 100.0 * share);
+            }
+        }
+
+        free(out);
+        free(ref);
+        free(f.data);
+    }
+
+    return failures;
+}
+
+static void
+parse_options(int argc, char **argv) {
+    static struct option opts[] = {
+        { "threads",    required_argument, 0, 'j' },
+        { "iterations", required_argument, 0, 'n' },
+        { "sizes",      required_argument, 0, 's' },
+        { "image",      required_argument, 0, 'i' },
+        { "output",     required_argument, 0, 'o' },
+        { "baseline",   required_argument, 0, 'b' },
+        { "tolerance",  required_argument, 0, 'r' },
+        { "trace",      required_argument, 0, 'T' },
+        { "verify",     no_argument,       0, 'V' },
+        { "kernels",    required_argument, 0, 'k' },
+        { "fixed",      no_argument,       0, 'x' },
+        { "help",       no_argument,       0, 'h' },
+        { 0, 0, 0, 0 },
+    };
+
+    for (;;) {
+        int opt = getopt_long(argc, argv, "j:n:s:i:o:b:r:T:Vk:xh", opts, NULL);
+        if (opt == -1)
+            break;
+
+        switch (opt) {
+            case 'j':
+                opt_threads = atoi(optarg);
+                break;
+            case 'n':
+                opt_iterations = atoi(optarg);
+                if (opt_iterations < 1)
+                    die("iterations must be at least 1\n");
+                break;
+            case 's':
+                opt_sizes = optarg;
+                break;
+            case 'i':
+                if (opt_nimages == MAX_FRAMES)
+                    die("too many images\n");
+                opt_images[opt_nimages++] = optarg;
+                break;
+            case 'o':
+                opt_output = optarg;
+                break;
+            case 'b':
+                opt_baseline = optarg;
+                break;
+            case 'r':
+                opt_tolerance = atof(optarg);
+                break;
+            case 'T':
+                opt_trace = optarg;
+                break;
+            case 'V':
+                opt_verify = 1;
+                break;
+            case 'x':
+                opt_fixed = 1;
+                break;
+            case 'k':
+                for (opt_impl = EFFECT_AVX2; opt_impl > EFFECT_AUTO; opt_impl--)
+                    if (!strcmp(optarg, effect_impl_name(opt_impl)))
+                        break;
+                if (opt_impl == EFFECT_AUTO && strcmp(optarg, "auto"))
+                    die("unknown kernels: %s\n", optarg);
+                break;
+            case 'h':
+            default:
+                die("usage: sxlock-bench [-V] [-x] [-k kernels] [-j threads] [-n iterations] [-s sizes] [-i image]... [-o file] [-b baseline] [-r percent]\n"
+                    "   -j threads: threads used for the effect (default: one per CPU)\n"
+                    "   -k kernels: scalar, sse2 or avx2 (default: the fastest supported)\n"
+                    "   -x: use the fixed-point engine\n"
+                    "   -n iterations: runs per frame, the fastest is reported (default: 5)\n"
+                    "   -s sizes: comma separated synthetic frames out of 1080p, 4k and 8k, or \"none\"\n"
+                    "   -i image: also run on a recorded screenshot (PNG, JPEG, ...)\n"
+                    "   -o file: write the results as JSON to file instead of stdout\n"
+                    "   -b baseline: compare against the JSON of an earlier run, fail on regressions\n"
+                    "   -r percent: slowdown or growth of the peak RSS tolerated by -b (default: 10)\n"
+                    "   -T file: write a Chrome trace of every stage to file\n"
+                    "   -V: check the effect against the golden hashes instead, and every\n"
+                    "       threaded or vectorized variant against the reference\n"
+                );
+        }
+    }
+}
+
+int
+main(int argc, char **argv) {
+    Result results[MAX_FRAMES + 3];
+    int count = 0;
+
+    parse_options(argc, argv);
+    if (opt_trace)
+        trace_open(opt_trace);
+
+    effect_init();
+    if (opt_verify) {
+        int failures = verify();
+        trace_close();
+        return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    if (!effect_set_impl(opt_impl))
+        die("%s kernels are not supported here\n", effect_impl_name(opt_impl));
+    effect_set_fixed(opt_fixed);
+    Pool *pool = pool_create(opt_threads);
+
+    /* frames are made one at a time and the peak RSS is reset before each,
+     * so the peak of a frame isn't inflated by the larger ones */
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        const char *p = strstr(opt_sizes, sizes[i].name);
+        size_t len = strlen(sizes[i].name);
+        Frame f;
+
+        if (!p || (p != opt_sizes && p[-1] != ',') || (p[len] != ',' && p[len] != '\0'))
+            continue;
+        peak_rss_reset();
+        frame_synthetic(&f, sizes[i].name, sizes[i].width, sizes[i].height);
+        run(&f, pool, &results[count++]);
+        free(f.data);
+    }
+    for (int i = 0; i < opt_nimages; i++) {
+        Frame f;
+
+        peak_rss_reset();
+        frame_load(&f, opt_images[i]);
+        run(&f, pool, &results[count++]);
+        free(f.data);
+    }
+    if (count == 0)
+        die("nothing to run, see -h\n");
+
+    print_table(results, count, pool_size(pool));
+
+    FILE *out = stdout;
+    if (opt_output && !(out = fopen(opt_output, "w")))
+        die("%s: cannot open output\n", opt_output);
+    write_json(out, results, count, pool_size(pool));
+    if (out != stdout)
+        fclose(out);
+
+    int regressions = 0;
+    if (opt_baseline)
+        regressions = compare_baseline(opt_baseline, results, count, pool_size(pool));
+
+    pool_destroy(pool);
+    trace_close();
+    return regressions ? EXIT_FAILURE : EXIT_SUCCESS;
+}
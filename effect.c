@@ -0,0 +1,885 @@
+/*
+ * MIT/X Consortium License, see LICENSE.
+ */
+
+// NOTE(ktravis): the following have been ported from https://github.com/r00tman/corrupter
+// it's not 100% correct or the same yet, but it's close
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "effect.h"
+#include "kernel.h"
+#include "trace.h"
+#include "ziggurat_inline.h"
+
+/* The frame is split into bands of this many rows, enough of them that one
+ * slow band doesn't leave the other threads idle at the end. */
+#define BAND_ROWS 64
+
+/* A row of the displacement field has this many planes of w offsets: for
+ * every stage and channel, how far to the side (or up and down) the pixels
+ * of the row are taken from, before wrapping around the frame. They are
+ * kept small enough for 8 bits by leaving out what is the same along many
+ * pixels, which applying adds back:
+ *  - the stage 1 x offsets leave out the shift of the block the pixel is in,
+ *    which only changes from one block to the next
+ *  - the stage 2 ones are relative to the channel drift at the start of the
+ *    row, which wanders off by tens of pixels over the frame
+ *  - stage 3 moves red and blue the same amount in opposite directions
+ * What is left is a few standard deviations of a normal, far below 128. */
+enum { F1_X, F1_Y, F2_R, F2_G, F2_B, F3_X, FIELD_PLANES };
+
+/* the block schedule and the drift are kept, they take a few bytes a row */
+struct EffectField {
+    int w, h;
+    int8_t *f;      // FIELD_PLANES * w offsets per row
+    double *drift;
+    struct Block *blocks;
+    int nblocks;
+};
+
+static const double mag = 7.0;
+static const int bheight = 10;
+static const double boffset = 30.0;
+static const double stride_mag = 0.1;
+static const double lag = 0.005;
+static const double lr0 = -7.0;
+static const double lg0 = 0.0;
+static const double lb0 = 3.0;
+static const double std_offset = 10.0;
+static const uint8_t add = 37;
+static const int meanabber = 10;
+static const double stdabber = 10.0;
+
+static EffectImpl impl = EFFECT_SCALAR;
+static int fixed;
+static SplitFunc split = split_scalar;
+static GatherFunc gather = gather_scalar;
+
+/* The random numbers are counter-based: every stream is keyed by the seed,
+ * and value i of row y of a stream only depends on (seed, stream, y, i), see
+ * r4_nor_ctr_fill(). Any part of the frame can be drawn in any order, so
+ * neither the number of threads nor the bands change it. The rows of the
+ * stage 1 block streams are the blocks. */
+enum {
+    RNG_S1_PIXEL,   // 2 per pixel
+    RNG_S1_BLOCK,   // 2 per block
+    RNG_S1_GAP,     // philox4x32() words, one counter per block
+    RNG_S2_WALK,    // 3 per pixel
+    RNG_S2_PIXEL,
+    RNG_S2_DRIFT,   // 3 per row
+    RNG_S3_PIXEL,
+};
+
+/* a distorted block of stage 1, it lasts until the next one begins */
+typedef struct Block {
+    int y, x;       // the pixel it begins at
+    int line_off;
+    double stride;
+} Block;
+
+typedef struct Corrupt {
+    uint32_t *src;
+    int w, h;
+    int nbands;
+    uint32_t *copy; // src before the effect, stage 1 reads from it
+    int8_t *field;  // the whole field, when it is made ahead of time
+    uint32_t seed;
+    double *drift;  // (lr, lg, lb) at the start of every row, plus one past the end
+    Block *blocks;  // in the order they begin
+    int nblocks;
+    uint64_t (*band_us)[3];    // time every band spent in every stage
+    int fixed;
+} Corrupt;
+
+/* A band runs all three stages row by row, so a row goes through them while
+ * it is in the cache. Every stage draws the normals of the row, and makes its
+ * planes of the field row before applying them. */
+typedef struct Band {
+    const Corrupt *c;
+    float *r;           // the normals of the row...
+    int32_t *q;         // ...scaled to Q16 for the fixed-point engine
+    int8_t *f;          // the field row, unless the whole field is made
+    int32_t *idx;       // source indices of the row, 3 per pixel
+    double *walk;       // stage 2 drift along the row
+    uint32_t *row1;     // the row after stage 1...
+    uint32_t *row2;     // ...and after stage 2
+
+    // the block of stage 1 the row is in, when it is applied
+    int b;
+    int line_off;
+    double stride;
+    int yset;
+} Band;
+
+// fills r with values [0, n) of row y of a stream
+static inline void
+nrand(uint32_t seed, int stream, uint32_t y, float *r, int n) {
+    uint32_t key[2] = { seed, (uint32_t)stream };
+    r4_nor_ctr_fill(key, y, 0, 0, r, n);
+}
+
+/* The fixed-point version of the above, for the band's row. The normals are
+ * scaled by qscale and converted to integers up front, so their consumers
+ * only do integer arithmetic. */
+static inline const int32_t *
+nrandq(Band *bd, int stream, int y, int n, float qscale) {
+    nrand(bd->c->seed, stream, (uint32_t)y, bd->r, n);
+    for (int i = 0; i < n; i++)
+        bd->q[i] = (int32_t)(bd->r[i] * qscale);
+    return bd->q;
+}
+
+// saturates an offset to the 8 bits of the field
+static inline int8_t sat8(int x) {
+    x = x < -128 ? -128 : x;
+    return (int8_t)(x > 127 ? 127 : x);
+}
+
+// the stage 2 offsets of row y are relative to the drift at its start
+static inline int drift_base(const Corrupt *c, int y, int i) {
+    return (int)c->drift[3*y+i];
+}
+
+// force x to stay in [0, b) range. x wraps around once if it is in [-b,2*b)
+// range, which it nearly always is; further out, e.g. on narrow frames or the
+// short strips of the animation, it sticks to the ends of that range.
+// written without branches, so the loops computing indices vectorize
+static inline int wrap(int x, int b) {
+    x = x < -b ? -b : x;
+    x = x > 2*b - 1 ? 2*b - 1 : x;
+    return x + (b & -(x < 0)) - (b & -(x >= b));
+}
+
+/* The offsets of the field are below 128 pixels, and the parts shared by
+ * many pixels are reduced to [-b/2, b/2) by wrap_half() first. On frames at
+ * least NEAR_MIN pixels a side that keeps them in [-b,2*b), so wrap_near()
+ * does without the clamping of wrap(). */
+#define NEAR_MIN 256
+
+static inline int wrap_near(int x, int b) {
+    return x + (b & -(x < 0)) - (b & -(x >= b));
+}
+
+static inline int wrap_half(int x, int b) {
+    x %= b;
+    if (x < -(b/2))
+        x += b;
+    else if (x >= b - b/2)
+        x -= b;
+    return x;
+}
+
+/* The fixed-point engine works in Q16. q16_int() truncates towards zero like
+ * a cast does, and relies on >> being an arithmetic shift. */
+#define Q16 65536
+static inline int q16_int(int32_t x) {
+    return (x + ((x >> 31) & (Q16 - 1))) >> 16;
+}
+
+// copies a band of rows of the source
+static void
+copy_rows(void *arg, int band) {
+    Corrupt *c = arg;
+    int y0 = band * BAND_ROWS;
+    int y1 = y0 + BAND_ROWS < c->h ? y0 + BAND_ROWS : c->h;
+    size_t w = c->w;
+
+    memcpy(c->copy + w * y0, c->src + w * y0, (y1 - y0) * w * sizeof(uint32_t));
+}
+
+/* On average every BHEIGHT lines a new distorted block begins, at any pixel.
+ * The gaps between the blocks are geometrically distributed, so they are
+ * drawn directly instead of trying every pixel. */
+static int
+draw_blocks(Corrupt *c) {
+    double q = log1p(-1.0 / (bheight * c->w));
+    uint32_t key[2] = { c->seed, RNG_S1_GAP };
+    int size = 16;
+
+    c->nblocks = 0;
+    c->blocks = malloc(size * sizeof(Block));
+    if (!c->blocks)
+        return 0;
+
+    for (double pos = -1.0; ; ) {
+        uint32_t ctr[4] = { (uint32_t)c->nblocks, 0, 0, 0 }, bits[4];
+        float r[2];
+
+        philox4x32(key, ctr, bits);
+        double u = ((bits[0] >> 1) + 1.0) / 2147483648.0;      // (0, 1]
+
+        pos += 1.0 + floor(log(u) / q);
+        if (pos >= (double)c->w * c->h)
+            break;
+
+        if (c->nblocks == size) {
+            Block *blocks = realloc(c->blocks, 2 * size * sizeof(Block));
+            if (!blocks)
+                return 0;
+            c->blocks = blocks;
+            size *= 2;
+        }
+
+        Block *bl = &c->blocks[c->nblocks++];
+        bl->y = (int)(pos / c->w);
+        bl->x = (int)(pos - (double)bl->y * c->w);
+        nrand(c->seed, RNG_S1_BLOCK, (uint32_t)(c->nblocks - 1), r, 2);
+        bl->line_off = (int)(r[0] * boffset);
+        bl->stride = stride_mag*r[1];
+    }
+    return 1;
+}
+
+// first stage is block displacement, blur and skew. the field only has the
+// blur, the blocks are added when it is applied
+static void
+field1(Band *bd, int y, int8_t *f) {
+    const Corrupt *c = bd->c;
+    const float *r = bd->r;
+    int w = c->w;
+    int8_t *fx = f + F1_X*w, *fy = f + F1_Y*w;
+
+    // every pixel takes two normals
+    nrand(c->seed, RNG_S1_PIXEL, (uint32_t)y, bd->r, 2*w);
+    for (int x = 0; x < w; x++) {
+        fx[x] = sat8((int)(r[2*x] * mag));
+        fy[x] = sat8((int)(r[2*x+1] * mag));
+    }
+}
+
+/* Steps into the block that begins at pixel x0 of row y, if one does, and
+ * returns where the part of the row that starts at x0 ends: where the next
+ * block begins, or at the end of the row. The shift of the part is that of
+ * the block it is in. */
+static int
+block_segment(Band *bd, int y, int x0, int *shift) {
+    const Corrupt *c = bd->c;
+
+    if (bd->b < c->nblocks && c->blocks[bd->b].y == y && c->blocks[bd->b].x == x0) {
+        bd->line_off = c->blocks[bd->b].line_off;
+        bd->stride = c->blocks[bd->b].stride;
+        bd->yset = y;
+        bd->b++;
+    }
+
+    // at the line where the block has begun, we don't want to offset the image
+    // so the skew offset (stride) is 0 on the block's line
+    *shift = bd->line_off + (int)(bd->stride * (double)(y - bd->yset));
+    return bd->b < c->nblocks && c->blocks[bd->b].y == y ? c->blocks[bd->b].x : c->w;
+}
+
+static void
+apply1(Band *bd, int y, const int8_t *f) {
+    const Corrupt *c = bd->c;
+    int w = c->w, h = c->h;
+    const int8_t *fx = f + F1_X*w, *fy = f + F1_Y*w;
+    int32_t *idx = bd->idx;
+
+    // offset is composed of the blur, block offset, and skew offset
+    for (int x0 = 0, x1, shift; x0 < w; x0 = x1) {
+        x1 = block_segment(bd, y, x0, &shift);
+        if (w >= NEAR_MIN && h >= NEAR_MIN) {
+            shift = wrap_half(shift, w);
+            for (int x = x0; x < x1; x++)
+                idx[x] = wrap_near(y + fy[x], h) * w + wrap_near(x + fx[x] + shift, w);
+        } else {
+            for (int x = x0; x < x1; x++)
+                idx[x] = wrap(y + fy[x], h) * w + wrap(x + fx[x] + shift, w);
+        }
+    }
+    gather(bd->row1, c->copy, idx, w);
+}
+
+// second stage is adding per-channel scan inconsistency and brightening
+static void
+field2(Band *bd, int y, int8_t *f) {
+    const Corrupt *c = bd->c;
+    const float *r = bd->r;
+    int w = c->w;
+    double *walk = bd->walk;
+    int8_t *fr = f + F2_R*w, *fg = f + F2_G*w, *fb = f + F2_B*w;
+    const double *d0 = &c->drift[3*y];
+    const double *d1 = &c->drift[3*(y+1)];
+    int br = drift_base(c, y, 0), bg = drift_base(c, y, 1), bb = drift_base(c, y, 2);
+
+    // random walk of the channel offsets along the row...
+    double sr = 0.0, sg = 0.0, sb = 0.0;
+    nrand(c->seed, RNG_S2_WALK, (uint32_t)y, bd->r, 3*w);
+    for (int x = 0; x < w; x++) {
+        sr += lag * r[3*x+0];
+        sg += lag * r[3*x+1];
+        sb += lag * r[3*x+2];
+        walk[3*x+0] = sr;
+        walk[3*x+1] = sg;
+        walk[3*x+2] = sb;
+    }
+
+    // ...pinned down so that it ends where the next row starts
+    double cr = (sr - (d1[0] - d0[0])) / w;
+    double cg = (sg - (d1[1] - d0[1])) / w;
+    double cb = (sb - (d1[2] - d0[2])) / w;
+
+    nrand(c->seed, RNG_S2_PIXEL, (uint32_t)y, bd->r, w);
+    for (int x = 0; x < w; x++) {
+        double lr = d0[0] + walk[3*x+0] - cr * (x+1);
+        double lg = d0[1] + walk[3*x+1] - cg * (x+1);
+        double lb = d0[2] + walk[3*x+2] - cb * (x+1);
+        int offx = (int)(r[x] * std_offset);
+
+        // source pixel of every channel. red/blue border is also smoothed by offx
+        fr[x] = sat8((int)(lr) - offx - br);
+        fg[x] = sat8((int)(lg) - bg);
+        fb[x] = sat8((int)(lb) + offx - bb);
+    }
+}
+
+static void
+apply2(Band *bd, int y, const int8_t *f) {
+    const Corrupt *c = bd->c;
+    int w = c->w;
+    const int8_t *fr = f + F2_R*w, *fg = f + F2_G*w, *fb = f + F2_B*w;
+    int32_t *ir = bd->idx, *ig = bd->idx + w, *ib = bd->idx + 2*w;
+    int br = drift_base(c, y, 0), bg = drift_base(c, y, 1), bb = drift_base(c, y, 2);
+
+    if (w >= NEAR_MIN) {
+        br = wrap_half(br, w);
+        bg = wrap_half(bg, w);
+        bb = wrap_half(bb, w);
+        for (int x = 0; x < w; x++) {
+            ir[x] = wrap_near(x + br + fr[x], w);
+            ig[x] = wrap_near(x + bg + fg[x], w);
+            ib[x] = wrap_near(x + bb + fb[x], w);
+        }
+    } else {
+        for (int x = 0; x < w; x++) {
+            ir[x] = wrap(x + br + fr[x], w);
+            ig[x] = wrap(x + bg + fg[x], w);
+            ib[x] = wrap(x + bb + fb[x], w);
+        }
+    }
+    split(bd->row2, bd->row1, ir, ig, ib, w, add);
+}
+
+// third stage is to add chromatic abberation
+static void
+field3(Band *bd, int y, int8_t *f) {
+    const float *r = bd->r;
+    int w = bd->c->w;
+    int8_t *fx = f + F3_X*w;
+
+    nrand(bd->c->seed, RNG_S3_PIXEL, (uint32_t)y, bd->r, w);
+    for (int x = 0; x < w; x++)
+        fx[x] = sat8(meanabber + (int)(r[x] * stdabber)); // lower offset arg = longer trails
+}
+
+static void
+apply3(Band *bd, int y, const int8_t *f) {
+    const Corrupt *c = bd->c;
+    int w = c->w;
+    const int8_t *fx = f + F3_X*w;
+    int32_t *ir = bd->idx, *ib = bd->idx + w;
+
+    // only red and blue are distorted
+    if (w >= NEAR_MIN) {
+        for (int x = 0; x < w; x++) {
+            ir[x] = wrap_near(x + fx[x], w);
+            ib[x] = wrap_near(x - fx[x], w);
+        }
+    } else {
+        for (int x = 0; x < w; x++) {
+            ir[x] = wrap(x + fx[x], w);
+            ib[x] = wrap(x - fx[x], w);
+        }
+    }
+    split(c->src + (size_t)w*y, bd->row2, ir, NULL, ib, w, 0);
+}
+
+/* The field of stages 1 to 3 again, with fixed-point arithmetic. Stage 1 and
+ * 3 draw normals in Q16 already scaled by their standard deviation, stage 2
+ * in plain Q16. The loops have no int/float conversions left, at the
+ * price of rounding differently from the reference now and then. */
+static void
+field1_fixed(Band *bd, int y, int8_t *f) {
+    int w = bd->c->w;
+    int8_t *fx = f + F1_X*w, *fy = f + F1_Y*w;
+    const int32_t *r = nrandq(bd, RNG_S1_PIXEL, y, 2*w, (float)(mag * Q16));
+
+    for (int x = 0; x < w; x++) {
+        fx[x] = sat8(q16_int(r[2*x]));
+        fy[x] = sat8(q16_int(r[2*x+1]));
+    }
+}
+
+/* the channel offsets of the row for field2_fixed(). walk is planar, and
+ * this is a function of its own so that restrict makes the loop vectorize */
+static void
+field2_fixed_row(int8_t *restrict fr, int8_t *restrict fg, int8_t *restrict fb,
+                 const int32_t *restrict walk, const int32_t *restrict r,
+                 const int32_t d0[3], const int32_t k[3], const int base[3], int w) {
+    const int32_t std_q8 = (int32_t)(std_offset * 256);
+    const int32_t *wr = walk, *wg = walk + w, *wb = walk + 2*w;
+    int32_t r0 = d0[0], g0 = d0[1], b0 = d0[2];
+    int32_t kr = k[0], kg = k[1], kb = k[2];
+    int br = base[0], bg = base[1], bb = base[2];
+
+    for (int x = 0; x < w; x++) {
+        int lr = q16_int(r0 + wr[x] - ((kr * (x+1)) >> 8));
+        int lg = q16_int(g0 + wg[x] - ((kg * (x+1)) >> 8));
+        int lb = q16_int(b0 + wb[x] - ((kb * (x+1)) >> 8));
+        int offx = q16_int((r[x] * std_q8) >> 8);
+
+        fr[x] = sat8(lr - offx - br);
+        fg[x] = sat8(lg - bg);
+        fb[x] = sat8(lb + offx - bb);
+    }
+}
+
+static void
+field2_fixed(Band *bd, int y, int8_t *f) {
+    const Corrupt *c = bd->c;
+    int w = c->w;
+    int32_t *walk = (int32_t*)bd->walk;
+    const int32_t lag_q = (int32_t)(lag * Q16 + 0.5);
+    int32_t d0[3], d1[3], k[3];
+    int base[3];
+
+    for (int i = 0; i < 3; i++) {
+        d0[i] = (int32_t)(c->drift[3*y+i] * Q16);
+        d1[i] = (int32_t)(c->drift[3*(y+1)+i] * Q16);
+        base[i] = drift_base(c, y, i);
+    }
+
+    // random walk of the channel offsets along the row, rounded to Q16...
+    int32_t sr = 0, sg = 0, sb = 0;
+    const int32_t *r = nrandq(bd, RNG_S2_WALK, y, 3*w, (float)Q16);
+    for (int x = 0; x < w; x++) {
+        sr += (r[3*x+0] * lag_q + Q16/2) >> 16;
+        sg += (r[3*x+1] * lag_q + Q16/2) >> 16;
+        sb += (r[3*x+2] * lag_q + Q16/2) >> 16;
+        walk[x] = sr;
+        walk[w+x] = sg;
+        walk[2*w+x] = sb;
+    }
+
+    // ...pinned down so that it ends where the next row starts. the slope is
+    // in Q24, it is far below a pixel per pixel
+    k[0] = (int32_t)(((int64_t)(sr - (d1[0] - d0[0])) * 256) / w);
+    k[1] = (int32_t)(((int64_t)(sg - (d1[1] - d0[1])) * 256) / w);
+    k[2] = (int32_t)(((int64_t)(sb - (d1[2] - d0[2])) * 256) / w);
+
+    r = nrandq(bd, RNG_S2_PIXEL, y, w, (float)Q16);
+    field2_fixed_row(f + F2_R*w, f + F2_G*w, f + F2_B*w, walk, r, d0, k, base, w);
+}
+
+static void
+field3_fixed(Band *bd, int y, int8_t *f) {
+    int w = bd->c->w;
+    int8_t *fx = f + F3_X*w;
+    const int32_t *r = nrandq(bd, RNG_S3_PIXEL, y, w, (float)(stdabber * Q16));
+
+    for (int x = 0; x < w; x++)
+        fx[x] = sat8(meanabber + q16_int(r[x]));
+}
+
+typedef void (*FieldFunc)(Band *bd, int y, int8_t *f);
+typedef void (*ApplyFunc)(Band *bd, int y, const int8_t *f);
+
+static const ApplyFunc applies[3] = { apply1, apply2, apply3 };
+
+/* Sets up band for its rows of c. Returns 0 if out of memory. */
+static int
+band_init(Band *bd, const Corrupt *c, int band) {
+    int w = c->w;
+    int y0 = band * BAND_ROWS;
+
+    bd->c = c;
+    bd->r = malloc(3 * w * sizeof(float));
+    bd->q = malloc(3 * w * sizeof(int32_t));
+    bd->f = malloc(FIELD_PLANES * w);
+    bd->idx = malloc(3 * w * sizeof(int32_t));
+    bd->walk = malloc(3 * w * sizeof(double));
+    bd->row1 = malloc(2 * w * sizeof(uint32_t));
+    bd->row2 = bd->row1 + w;
+
+    // continue the block the band starts in, the image starts undistorted
+    bd->b = 0;
+    while (bd->b < c->nblocks && c->blocks[bd->b].y < y0)
+        bd->b++;
+    bd->line_off = bd->b > 0 ? c->blocks[bd->b-1].line_off : 0;
+    bd->stride = bd->b > 0 ? c->blocks[bd->b-1].stride : 0.0;
+    bd->yset = bd->b > 0 ? c->blocks[bd->b-1].y : 0;
+
+    return bd->r && bd->q && bd->f && bd->idx && bd->walk && bd->row1;
+}
+
+static void
+band_free(Band *bd) {
+    free(bd->row1);
+    free(bd->walk);
+    free(bd->idx);
+    free(bd->f);
+    free(bd->q);
+    free(bd->r);
+}
+
+/* Makes the field of a band and applies it row by row, or only makes it if
+ * the whole field is wanted. */
+static void
+run_band(void *arg, int band) {
+    Corrupt *c = arg;
+    size_t w = c->w;
+    int y0 = band * BAND_ROWS;
+    int y1 = y0 + BAND_ROWS < c->h ? y0 + BAND_ROWS : c->h;
+    FieldFunc fields[3] = { field1, field2, field3 };
+    Band bd;
+
+    uint64_t t = trace_now();
+    if (c->fixed) {
+        fields[0] = field1_fixed;
+        fields[1] = field2_fixed;
+        fields[2] = field3_fixed;
+    }
+    if (!band_init(&bd, c, band))
+        goto out;
+
+    for (int y = y0; y < y1; y++) {
+        if (c->field) {
+            int8_t *f = c->field + FIELD_PLANES * w * y;
+            for (int i = 0; i < 3; i++)
+                fields[i](&bd, y, f);
+            continue;
+        }
+
+        for (int i = 0; i < 3; i++) {
+            uint64_t t0 = trace_now();
+            fields[i](&bd, y, bd.f);
+            applies[i](&bd, y, bd.f);
+            c->band_us[band][i] += trace_now() - t0;
+        }
+    }
+
+out:
+    band_free(&bd);
+    trace_span("band", t);
+}
+
+/* applies a band of a field made ahead of time */
+static void
+apply_band(void *arg, int band) {
+    Corrupt *c = arg;
+    size_t w = c->w;
+    int y0 = band * BAND_ROWS;
+    int y1 = y0 + BAND_ROWS < c->h ? y0 + BAND_ROWS : c->h;
+    Band bd;
+
+    uint64_t t = trace_now();
+    if (!band_init(&bd, c, band))
+        goto out;
+
+    for (int y = y0; y < y1; y++) {
+        const int8_t *f = c->field + FIELD_PLANES * w * y;
+        for (int i = 0; i < 3; i++)
+            applies[i](&bd, y, f);
+    }
+
+out:
+    band_free(&bd);
+    trace_span("apply band", t);
+}
+
+/* The channel drift of stage 2 is a random walk over the whole frame. Its
+ * value at the start of every row is drawn here, one step per row, so the
+ * bands can walk their rows independently. The stage 1 blocks are drawn
+ * too. Returns 0 if out of memory. */
+static int
+draw_frame(Corrupt *c) {
+    double row_lag = lag * sqrt(c->w);
+
+    c->drift = malloc(3 * (c->h+1) * sizeof(double));
+    c->blocks = NULL;
+    if (!c->drift)
+        return 0;
+
+    c->drift[0] = lr0;
+    c->drift[1] = lg0;
+    c->drift[2] = lb0;
+    for (int y = 1; y <= c->h; y++) {
+        float r[3];
+
+        nrand(c->seed, RNG_S2_DRIFT, (uint32_t)y, r, 3);
+        for (int i = 0; i < 3; i++)
+            c->drift[3*y+i] = c->drift[3*(y-1)+i] + row_lag * r[i];
+    }
+    return draw_blocks(c);
+}
+
+void
+effect_init(void) {
+    effect_set_impl(EFFECT_AUTO);
+}
+
+int
+effect_set_impl(EffectImpl which) {
+    if (which == EFFECT_AUTO) {
+        static const EffectImpl best[] = { EFFECT_AVX2, EFFECT_SSE2, EFFECT_SCALAR };
+        for (int i = 0; ; i++)
+            if (effect_set_impl(best[i]))
+                return 1;
+    }
+
+    if (!kernel_supported(which))
+        return 0;
+
+    switch (which) {
+#if defined(__x86_64__) || defined(__i386__)
+        case EFFECT_AVX2:
+            split = split_avx2;
+            gather = gather_avx2;
+            break;
+        case EFFECT_SSE2:
+            split = split_sse2;
+            gather = gather_scalar;
+            break;
+#endif
+        default:
+            split = split_scalar;
+            gather = gather_scalar;
+            break;
+    }
+    impl = which;
+    return 1;
+}
+
+EffectImpl
+effect_get_impl(void) {
+    return impl;
+}
+
+void
+effect_set_fixed(int on) {
+    fixed = on;
+}
+
+int
+effect_get_fixed(void) {
+    return fixed;
+}
+
+const char *
+effect_impl_name(EffectImpl which) {
+    static const char *names[] = { "auto", "scalar", "sse2", "avx2" };
+    return names[which];
+}
+
+void
+corrupt_it(uint32_t *data, int w, int h, uint32_t seed, Pool *pool, EffectTimes *times) {
+    EffectTimes t;
+    Corrupt c;
+
+    c.src = data;
+    c.w = w;
+    c.h = h;
+    c.seed = seed;
+    c.fixed = fixed;
+    c.field = NULL;
+    c.nbands = (h + BAND_ROWS - 1) / BAND_ROWS;
+
+    c.copy = malloc(4 * (size_t)w * h);
+    c.band_us = calloc(c.nbands, sizeof(*c.band_us));
+    uint64_t start = trace_now();
+    if (!draw_frame(&c) || !c.copy || !c.band_us)
+        goto out;
+    trace_span("drift", start);
+    t.drift = trace_now() - start;
+
+    /* the stages overlap, each gets its share of the time the bands took */
+    {
+        start = trace_now();
+        pool_run(pool, copy_rows, &c, c.nbands);
+        trace_span("copy", start);
+        uint64_t copy = trace_now() - start;
+
+        start = trace_now();
+        pool_run(pool, run_band, &c, c.nbands);
+        uint64_t wall = trace_now() - start;
+
+        uint64_t sum[3] = { 0, 0, 0 };
+        for (int band = 0; band < c.nbands; band++)
+            for (int i = 0; i < 3; i++)
+                sum[i] += c.band_us[band][i];
+        uint64_t total = sum[0] + sum[1] + sum[2];
+        for (int i = 0; i < 3; i++)
+            t.stage[i] = total ? wall * sum[i] / total : 0;
+        t.stage[0] += copy;
+    }
+    if (times)
+        *times = t;
+
+out:
+    free(c.blocks);
+    free(c.band_us);
+    free(c.drift);
+    free(c.copy);
+}
+
+/* The bands of several frames, handed out by a single pool_run(). Band i
+ * of the lot is band i - first[f] of frame f. */
+typedef struct Frames {
+    Corrupt *c;
+    int *first;     // the first band of every frame, and the total
+} Frames;
+
+static Corrupt *
+frames_band(Frames *fr, int index, int *band) {
+    int f = 0;
+
+    while (index >= fr->first[f+1])
+        f++;
+    *band = index - fr->first[f];
+    return &fr->c[f];
+}
+
+static void
+copy_frames(void *arg, int index) {
+    int band;
+    Corrupt *c = frames_band(arg, index, &band);
+
+    copy_rows(c, band);
+}
+
+static void
+run_frames(void *arg, int index) {
+    int band;
+    Corrupt *c = frames_band(arg, index, &band);
+
+    run_band(c, band);
+}
+
+void
+corrupt_frames(const EffectFrame *frames, int n, Pool *pool) {
+    Frames fr;
+    int ok = 1;
+
+    fr.c = calloc(n, sizeof(Corrupt));
+    fr.first = malloc((n + 1) * sizeof(int));
+    if (!fr.c || !fr.first)
+        goto out;
+
+    uint64_t start = trace_now();
+    fr.first[0] = 0;
+    for (int i = 0; i < n; i++) {
+        Corrupt *c = &fr.c[i];
+
+        c->src = frames[i].data;
+        c->w = frames[i].w;
+        c->h = frames[i].h;
+        c->seed = frames[i].seed;
+        c->fixed = fixed;
+        c->nbands = (c->h + BAND_ROWS - 1) / BAND_ROWS;
+        c->copy = malloc(4 * (size_t)c->w * c->h);
+        c->band_us = calloc(c->nbands, sizeof(*c->band_us));
+        fr.first[i+1] = fr.first[i] + c->nbands;
+        if (!draw_frame(c) || !c->copy || !c->band_us)
+            ok = 0;
+    }
+    trace_span("drift", start);
+
+    if (ok) {
+        pool_run(pool, copy_frames, &fr, fr.first[n]);
+        pool_run(pool, run_frames, &fr, fr.first[n]);
+    }
+
+out:
+    for (int i = 0; fr.c && i < n; i++) {
+        free(fr.c[i].blocks);
+        free(fr.c[i].band_us);
+        free(fr.c[i].drift);
+        free(fr.c[i].copy);
+    }
+    free(fr.first);
+    free(fr.c);
+}
+
+EffectField *
+effect_field_new(int w, int h, uint32_t seed, Pool *pool) {
+    EffectField *field = malloc(sizeof(EffectField));
+    Corrupt c;
+
+    c.src = NULL;
+    c.copy = NULL;
+    c.w = w;
+    c.h = h;
+    c.seed = seed;
+    c.fixed = fixed;
+    c.nbands = (h + BAND_ROWS - 1) / BAND_ROWS;
+    c.band_us = NULL;
+    c.field = malloc(FIELD_PLANES * (size_t)w * h);
+
+    uint64_t start = trace_now();
+    if (!draw_frame(&c) || !field || !c.field) {
+        free(c.blocks);
+        free(c.drift);
+        free(c.field);
+        free(field);
+        return NULL;
+    }
+    pool_run(pool, run_band, &c, c.nbands);
+    trace_span("field", start);
+
+    field->w = w;
+    field->h = h;
+    field->f = c.field;
+    field->drift = c.drift;
+    field->blocks = c.blocks;
+    field->nblocks = c.nblocks;
+    return field;
+}
+
+void
+effect_field_free(EffectField *field) {
+    if (!field)
+        return;
+    free(field->blocks);
+    free(field->drift);
+    free(field->f);
+    free(field);
+}
+
+int
+effect_field_width(const EffectField *field) {
+    return field->w;
+}
+
+int
+effect_field_height(const EffectField *field) {
+    return field->h;
+}
+
+void
+effect_field_apply(const EffectField *field, uint32_t *data, Pool *pool) {
+    Corrupt c;
+
+    /* only the frame and the field are needed, the bands don't draw */
+    memset(&c, 0, sizeof(c));
+    c.src = data;
+    c.w = field->w;
+    c.h = field->h;
+    c.field = field->f;
+    c.drift = field->drift;
+    c.blocks = field->blocks;
+    c.nblocks = field->nblocks;
+    c.nbands = (c.h + BAND_ROWS - 1) / BAND_ROWS;
+
+    c.copy = malloc(4 * (size_t)c.w * c.h);
+    if (!c.copy)
+        return;
+
+    uint64_t start = trace_now();
+    pool_run(pool, copy_rows, &c, c.nbands);
+    pool_run(pool, apply_band, &c, c.nbands);
+    trace_span("apply", start);
+    free(c.copy);
+}
@@ -0,0 +1,74 @@
+/*
+ * The glitch effect applied to the captured screen.
+ */
+
+#ifndef EFFECT_H
+#define EFFECT_H
+
+#include <stdint.h>
+
+#include "pool.h"
+
+/* implementations of the per-pixel kernels, they all draw the same frame */
+typedef enum EffectImpl {
+    EFFECT_AUTO,        // the fastest one the CPU supports
+    EFFECT_SCALAR,      // the reference
+    EFFECT_SSE2,
+    EFFECT_AVX2,
+} EffectImpl;
+
+/* picks the fastest kernels, call once before corrupt_it() */
+void effect_init(void);
+
+/* Selects the kernels used by corrupt_it(). Returns 0 if this build or CPU
+ * can't run impl, and keeps the current ones. */
+int effect_set_impl(EffectImpl impl);
+EffectImpl effect_get_impl(void);
+const char *effect_impl_name(EffectImpl impl);
+
+/* Selects the fixed-point engine, which does the per-pixel math of the
+ * effect in integers. Its frames look the same but are not bit-identical to
+ * the floating point ones; every now and then a pixel is taken from a
+ * neighbour of the one the reference picks. */
+void effect_set_fixed(int on);
+int effect_get_fixed(void);
+
+/* wall time of the parts of a corrupt_it() call, in microseconds */
+typedef struct EffectTimes {
+    uint64_t drift;     // the per-frame drift and block schedule
+    uint64_t stage[3];  // the stages run interleaved, this is their share
+} EffectTimes;
+
+/* Corrupts a w x h frame of 32-bit BGRA pixels in place. The result only
+ * depends on the frame and the seed. The frame is split into bands of rows
+ * that run on the threads of pool, which may be NULL to do all the work on
+ * the calling thread. If times is not NULL, it receives the time spent in
+ * every stage. */
+void corrupt_it(uint32_t *data, int w, int h, uint32_t seed, Pool *pool, EffectTimes *times);
+
+/* Corrupts n frames at once, each as corrupt_it() would. The bands of all
+ * the frames share the threads of pool, so small frames don't leave them
+ * idle, e.g. the monitors of a multi-head setup. */
+typedef struct EffectFrame {
+    uint32_t *data;
+    int w, h;
+    uint32_t seed;
+} EffectFrame;
+
+void corrupt_frames(const EffectFrame *frames, int n, Pool *pool);
+
+/* The effect split in two: where every pixel of every stage is taken from,
+ * and taking them. The field only depends on the size, the seed and the
+ * engine, so it can be made ahead of time, e.g. while the screen is being
+ * captured, and applied to any number of frames of that size. Applying it
+ * draws the same frame as corrupt_it(). A field takes 6 bytes per pixel.
+ * effect_field_new() returns NULL if out of memory. */
+typedef struct EffectField EffectField;
+
+EffectField *effect_field_new(int w, int h, uint32_t seed, Pool *pool);
+void effect_field_free(EffectField *field);
+int effect_field_width(const EffectField *field);
+int effect_field_height(const EffectField *field);
+void effect_field_apply(const EffectField *field, uint32_t *data, Pool *pool);
+
+#endif
@@ -0,0 +1,118 @@
+// Writes the ziggurat tables of ziggurat_inline.c as C source to stdout.
+// It runs at build time, so the tables are constant data instead of being
+// set up at run time; see the Makefile.
+//
+// The setup is the one of R4_NOR_SETUP and R4_EXP_SETUP from:
+//  https://people.sc.fsu.edu/~jburkardt/c_src/ziggurat_inline/ziggurat_inline.html
+//
+# include <stdio.h>
+# include <math.h>
+# include <stdint.h>
+
+static float fe[256];
+static float fn[128];
+static uint32_t ke[256];
+static uint32_t kn[128];
+static float we[256];
+static float wn[128];
+
+static void r4_exp_setup ( )
+{
+  double de = 7.697117470131487;
+  int i;
+  const double m2 = 4294967296.0;
+  double q;
+  double te = 7.697117470131487;
+  const double ve = 3.949659822581572e-03;
+
+  q = ve / exp ( - de );
+
+  ke[0] = ( uint32_t ) ( ( de / q ) * m2 );
+  ke[1] = 0;
+
+  we[0] = ( float ) ( q / m2 );
+  we[255] = ( float ) ( de / m2 );
+
+  fe[0] = 1.0;
+  fe[255] = ( float ) ( exp ( - de ) );
+
+  for ( i = 254; 1 <= i; i-- )
+  {
+    de = - log ( ve / de + exp ( - de ) );
+    ke[i+1] = ( uint32_t ) ( ( de / te ) * m2 );
+    te = de;
+    fe[i] = ( float ) ( exp ( - de ) );
+    we[i] = ( float ) ( de / m2 );
+  }
+}
+
+static void r4_nor_setup ( )
+{
+  double dn = 3.442619855899;
+  int i;
+  const double m1 = 2147483648.0;
+  double q;
+  double tn = 3.442619855899;
+  const double vn = 9.91256303526217e-03;
+
+  q = vn / exp ( - 0.5 * dn * dn );
+
+  kn[0] = ( uint32_t ) ( ( dn / q ) * m1 );
+  kn[1] = 0;
+
+  wn[0] = ( float ) ( q / m1 );
+  wn[127] = ( float ) ( dn / m1 );
+
+  fn[0] = 1.0;
+  fn[127] = ( float ) exp ( - 0.5 * dn * dn );
+
+  for ( i = 126; 1 <= i; i-- )
+  {
+    dn = sqrt ( - 2.0 * log ( vn / dn + exp ( - 0.5 * dn * dn ) ) );
+    kn[i+1] = ( uint32_t ) ( ( dn / tn ) * m1 );
+    tn = dn;
+    fn[i] = ( float ) exp ( - 0.5 * dn * dn );
+    wn[i] = ( float ) ( dn / m1 );
+  }
+}
+
+static void print_uint ( const char *name, const uint32_t *t, int n )
+{
+  int i;
+
+  printf ( "static const uint32_t %s[%d] = {", name, n );
+  for ( i = 0; i < n; i++ )
+  {
+    printf ( "%s0x%08lx,", i % 6 ? " " : "\n  ", ( unsigned long ) t[i] );
+  }
+  printf ( "\n};\n\n" );
+}
+
+// hexadecimal floating point constants keep the values exact
+static void print_float ( const char *name, const float *t, int n )
+{
+  int i;
+
+  printf ( "static const float %s[%d] = {", name, n );
+  for ( i = 0; i < n; i++ )
+  {
+    printf ( "%s%a,", i % 4 ? " " : "\n  ", ( double ) t[i] );
+  }
+  printf ( "\n};\n\n" );
+}
+
+int main ( )
+{
+  r4_nor_setup ( );
+  r4_exp_setup ( );
+
+  printf ( "// Generated by ziggurat_gen.c, do not edit.\n\n" );
+  print_uint ( "kn", kn, 128 );
+  print_float ( "fn", fn, 128 );
+  print_float ( "wn", wn, 128 );
+  print_uint ( "ke", ke, 256 );
+  print_float ( "fe", fe, 256 );
+  print_float ( "we", we, 256 );
+
+  return ferror ( stdout ) ? 1 : 0;
+}
@@ -8,20 +8,15 @@
 # include <time.h>
 
 # include "ziggurat_inline.h"
-
-static float fe[256];
-static float fn[128];
-static int32_t hz;
-static uint32_t iz;
-static uint32_t jcong = 234567891;
-static uint32_t jsr = 123456789;
-static uint32_t jz;
-static uint32_t ke[256];
-static uint32_t kn[128];
-static uint32_t w = 345678912;
-static float we[256];
-static float wn[128];
-static uint32_t z = 456789123;
+/*
+  KN, FN, WN and KE, FE, WE are generated at build time by ziggurat_gen.c.
+*/
+# include "ziggurat_tables.h"
+/*
+  The state of the functions that don't take one, like KISS_VALUE and
+  R4_NOR_VALUE.  They are not reentrant, the ZIG_* functions are.
+*/
+static zig_state zig_default = { 123456789, 234567891, 345678912, 456789123 };
 /*
   The original SHR3 random number generator was replaced by
   KISS, a combination of MWC, CONG and SHR3 as suggested in
@@ -29,17 +24,78 @@ static uint32_t z = 456789123;
 
   Thanks to Dirk Eddelbuettel, 04 October 2013.
 */
-# define znew ( z = 36969 * ( z & 65535 ) + ( z >> 16 ) )
-# define wnew ( w = 18000 * ( w & 65535 ) + ( w >> 16 ) )
-# define MWC ( ( znew << 16 ) + wnew )
-# define SHR3 ( jz = jsr, jsr ^= ( jsr << 13 ), jsr ^= ( jsr >> 17 ), jsr ^= ( jsr << 5 ), jz + jsr )
-# define CONG ( jcong = 69069 * jcong + 1234567 )
-# define KISS ( ( MWC ^ CONG ) + SHR3 )
-
-# define UNI ( 0.5 + ( signed ) KISS * 0.2328306e-09 )
-# define IUNI KISS
-# define RNOR ( hz = KISS, iz = hz & 127, ( fabs ( hz ) < kn[iz] ) ? hz * wn[iz] : nfix() )
-# define REXP ( jz = KISS, iz = jz & 255, (        jz   < ke[iz] ) ? jz * we[iz] : efix() )
+static uint32_t zig_abs ( int32_t hz )
+{
+  return hz < 0 ? - ( uint32_t ) hz : ( uint32_t ) hz;
+}
+/*
+  UNI of the original code.  It is a double, so the logarithms and the wedge
+  tests of ZIG_NFIX and ZIG_EFIX round like those of NFIX and EFIX did.
+*/
+static double zig_unid ( zig_state *s )
+{
+  return 0.5 + ( signed ) zig_kiss ( s ) * 0.2328306e-09;
+}
+
+/*
+  PHILOX_BLOCKS runs PHILOX4X32 on the counters ( C0 + J, C1, C2, C3 ) for
+  J < N, and stores the 4 words of every counter consecutively in OUT.  The
+  rounds run over all the counters at once, so the loop over the counters
+  is turned into SIMD code.  N is at most PHILOX_BATCH.
+*/
+# define PHILOX_BATCH 64
+# define PHILOX_M0 0xd2511f53u
+# define PHILOX_M1 0xcd9e8d57u
+# define PHILOX_W0 0x9e3779b9u
+# define PHILOX_W1 0xbb67ae85u
+
+static void philox_blocks ( const uint32_t key[2], uint32_t c0, uint32_t c1,
+  uint32_t c2, uint32_t c3, int n, uint32_t *out )
+{
+  uint32_t x0[PHILOX_BATCH];
+  uint32_t x1[PHILOX_BATCH];
+  uint32_t x2[PHILOX_BATCH];
+  uint32_t x3[PHILOX_BATCH];
+  uint32_t k0 = key[0];
+  uint32_t k1 = key[1];
+  int j;
+  int round;
+
+  for ( j = 0; j < n; j++ )
+  {
+    x0[j] = c0 + ( uint32_t ) j;
+    x1[j] = c1;
+    x2[j] = c2;
+    x3[j] = c3;
+  }
+
+  for ( round = 0; round < 10; round++ )
+  {
+    for ( j = 0; j < n; j++ )
+    {
+      uint64_t p0 = ( uint64_t ) PHILOX_M0 * x0[j];
+      uint64_t p1 = ( uint64_t ) PHILOX_M1 * x2[j];
+      uint32_t y0 = ( uint32_t ) ( p1 >> 32 ) ^ x1[j] ^ k0;
+      uint32_t y2 = ( uint32_t ) ( p0 >> 32 ) ^ x3[j] ^ k1;
+
+      x1[j] = ( uint32_t ) p1;
+      x3[j] = ( uint32_t ) p0;
+      x0[j] = y0;
+      x2[j] = y2;
+    }
+    k0 += PHILOX_W0;
+    k1 += PHILOX_W1;
+  }
+
+  for ( j = 0; j < n; j++ )
+  {
+    out[4*j+0] = x0[j];
+    out[4*j+1] = x1[j];
+    out[4*j+2] = x2[j];
+    out[4*j+3] = x3[j];
+  }
+  return;
+}
 
 /******************************************************************************/
 
@@ -136,7 +192,7 @@ uint32_t cong_value ( )
     Output, uint32_t CONG_VALUE, the randomly chosen value.
 */
 {
-  return CONG;
+  return cong_seeded ( &zig_default.jcong );
 }
 /*******************************************************************************/
 
@@ -169,17 +225,17 @@ double cpu_time ( )
 }
 /******************************************************************************/
 
-float efix ( )
+static float zig_efix ( zig_state *s, uint32_t jz, uint32_t iz )
 
 /******************************************************************************/
 /* 
   Purpose:
 
-    EFIX generates variates when rejection occurs in the exponential code. 
+    ZIG_EFIX generates variates when rejection occurs in the exponential code. 
 
   Discussion:
 
-    This routine is NOT designed for direct calls by the user!
+    JZ is the rejected candidate of ZIG_EXP, IZ its strip.
 
   Licensing:
 
@@ -220,18 +276,18 @@ float efix ( )
 */
     if ( iz == 0 )
     {
-      return ( 7.69711 - log ( UNI ) );
+      return ( 7.69711 - log ( zig_unid ( s ) ) );
     }
 
     x = jz * we[iz];
-    if ( fe[iz] + UNI * ( fe[iz-1] - fe[iz] ) < exp ( - x ) ) 
+    if ( fe[iz] + zig_unid ( s ) * ( fe[iz-1] - fe[iz] ) < exp ( - x ) ) 
     {
       return x;
     }
 /* 
   Initiate, try to exit the loop.
 */
-    jz = KISS;
+    jz = zig_kiss ( s );
     iz = ( jz & 255 );
     if ( jz < ke[iz] ) 
     {
@@ -331,7 +387,7 @@ uint32_t kiss_value ( )
     Output, uint32_t KISS_VALUE, the randomly chosen value.
 */
 {
-  return KISS;
+  return zig_kiss ( &zig_default );
 }
 /******************************************************************************/
 
@@ -428,21 +484,21 @@ uint32_t mwc_value ( )
     Output, uint32_t MWC_VALUE, the randomly chosen value.
 */
 {
-  return MWC;
+  return mwc_seeded ( &zig_default.w, &zig_default.z );
 }
 /******************************************************************************/
 
-float nfix ( )
+static float zig_nfix ( zig_state *s, int32_t hz, uint32_t iz )
 
 /******************************************************************************/
 /*
   Purpose:
  
-    NFIX generates variates when rejection occurs in the normal code.
+    ZIG_NFIX generates variates when rejection occurs in the normal code.
 
   Discussion:
 
-    This routine is NOT designed for direct calls by the user!
+    HZ is the rejected candidate of ZIG_NOR or R4_NOR_CTR_FILL, IZ its strip.
 
   Licensing:
 
@@ -475,8 +531,8 @@ float nfix ( )
 */
 {
   const float r = 3.442620;
-  static float x;
-  static float y;
+  float x;
+  float y;
 
   for ( ; ; )
   {
@@ -488,8 +544,8 @@ float nfix ( )
     { 
       do
       {
-        x = - log ( UNI ) * 0.2904764; 
-        y = - log ( UNI );
+        x = - log ( zig_unid ( s ) ) * 0.2904764; 
+        y = - log ( zig_unid ( s ) );
       }
       while ( y + y < x * x );
 
@@ -498,16 +554,16 @@ float nfix ( )
 /* 
   0 < IZ, handle the wedges of other strips.
 */
-    if ( fn[iz] + UNI * ( fn[iz-1] - fn[iz] ) < exp ( - 0.5 * x * x ) ) 
+    if ( fn[iz] + zig_unid ( s ) * ( fn[iz-1] - fn[iz] ) < exp ( - 0.5 * x * x ) ) 
     {
       return x;
     }
 /* 
   Initiate, try to exit the loop.
 */
-    hz = KISS;
+    hz = ( int32_t ) zig_kiss ( s );
     iz = ( hz & 127 );
-    if ( fabs ( hz ) < kn[iz] )
+    if ( zig_abs ( hz ) < kn[iz] )
     {
       return ( ( float ) ( hz * wn[iz] ) );
     }
@@ -515,6 +571,45 @@ float nfix ( )
 }
 /******************************************************************************/
 
+void philox4x32 ( const uint32_t key[2], const uint32_t ctr[4], uint32_t out[4] )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    PHILOX4X32 is the Philox4x32-10 counter-based random number generator.
+
+  Discussion:
+
+    The output is a bijection of the 128 bit counter CTR under the 64 bit
+    KEY, so there is no state: every counter gives 4 random words, and any
+    of them can be computed without computing the others first.  Different
+    counters or keys give independent words, so a stream can be laid out
+    over e.g. the pixels of an image and generated in any order, by any
+    number of threads.
+
+  Reference:
+
+    John Salmon, Mark Moraes, Ron Dror, David Shaw,
+    Parallel Random Numbers: As Easy as 1, 2, 3,
+    Proceedings of the International Conference for High Performance
+    Computing, Networking, Storage and Analysis, November 2011.
+
+  Parameters:
+
+    Input, const uint32_t KEY[2], the key.
+
+    Input, const uint32_t CTR[4], the counter.
+
+    Output, uint32_t OUT[4], the random words.
+*/
+{
+  philox_blocks ( key, ctr[0], ctr[1], ctr[2], ctr[3], 1, out );
+
+  return;
+}
+/******************************************************************************/
+
 void r4_exp_setup ( )
 
 /******************************************************************************/
@@ -523,6 +618,11 @@ void r4_exp_setup ( )
 
     R4_EXP_SETUP sets data needed by R4_EXP.
 
+  Discussion:
+
+    The tables are generated at build time by ziggurat_gen.c now, so there
+    is nothing left to do.  Kept for compatibility.
+
   Licensing:
 
     This code is distributed under the GNU LGPL license.
@@ -555,32 +655,6 @@ void r4_exp_setup ( )
     Global, float FE[256], WE[256], data needed by R4_EXP.
 */
 {
-  double de = 7.697117470131487;
-  int i;
-  const double m2 = 4294967296.0;
-  double q;
-  double te = 7.697117470131487;
-  const double ve = 3.949659822581572e-03;
-
-  q = ve / exp ( - de );
-
-  ke[0] = ( uint32_t ) ( ( de / q ) * m2 );
-  ke[1] = 0;
-
-  we[0] = ( float ) ( q / m2 );
-  we[255] = ( float ) ( de / m2 );
-
-  fe[0] = 1.0;
-  fe[255] = ( float ) ( exp ( - de ) );
-
-  for ( i = 254; 1 <= i; i-- )
-  {
-    de = - log ( ve / de + exp ( - de ) );
-    ke[i+1] = ( uint32_t ) ( ( de / te ) * m2 );
-    te = de;
-    fe[i] = ( float ) ( exp ( - de ) );
-    we[i] = ( float ) ( de / m2 );
-  }
   return;
 }
 /******************************************************************************/
@@ -600,8 +674,8 @@ float r4_exp_value ( )
 
     The underlying algorithm is the ziggurat method.
 
-    Before calling this function, the user must call ZIGSET, supplying
-    a nonzero seed.
+    This function uses internally managed seeds, which can be set by
+    ZIGSET.  ZIG_EXP and ZIG_NOR are the reentrant versions.
 
   Licensing:
 
@@ -633,7 +707,78 @@ float r4_exp_value ( )
     Output, float R4_EXP_VALUE, an exponentially distributed random value.
 */
 {
-  return REXP;
+  return zig_exp ( &zig_default );
+}
+/******************************************************************************/
+
+void r4_nor_ctr_fill ( const uint32_t key[2], uint32_t c1, uint32_t c2,
+  uint32_t first, float *out, int n )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    R4_NOR_CTR_FILL fills an array with counter-based normal floats.
+
+  Discussion:
+
+    Value number I of the stream ( KEY, C1, C2 ) is made from word I % 4 of
+    PHILOX4X32 on the counter ( I / 4, C1, C2, 0 ), so it does not depend on
+    any other value.  OUT receives the values FIRST to FIRST + N - 1, and a
+    stream can be generated piecewise, in any order.
+
+    A rejected candidate is finished by ZIG_NFIX on a KISS state seeded from
+    the counter ( I, C1, C2, 1 ), which is never used otherwise.
+
+  Parameters:
+
+    Input, const uint32_t KEY[2], the key of the stream.
+
+    Input, uint32_t C1, C2, the counter words that select the stream.
+
+    Input, uint32_t FIRST, the number of the first value.
+
+    Output, float OUT[N], the normal variates.
+
+    Input, int N, the number of values to generate.
+*/
+{
+  uint32_t bits[4*PHILOX_BATCH];
+  int i;
+  int j;
+
+  for ( i = 0; i < n; )
+  {
+    uint32_t skip = ( first + i ) % 4;
+    int m = n - i + skip < 4 * PHILOX_BATCH ? n - i + skip : 4 * PHILOX_BATCH;
+
+    philox_blocks ( key, ( first + i ) / 4, c1, c2, 0, ( m + 3 ) / 4, bits );
+
+    for ( j = skip; j < m; j++, i++ )
+    {
+      int32_t hz = ( int32_t ) bits[j];
+      uint32_t iz = ( hz & 127 );
+
+      if ( zig_abs ( hz ) < kn[iz] )
+      {
+        out[i] = hz * wn[iz];
+      }
+      else
+      {
+        uint32_t seed[4];
+        uint32_t ctr[4] = { first + i, c1, c2, 1 };
+        zig_state s;
+
+        philox4x32 ( key, ctr, seed );
+        s.jsr = seed[0] | 1;
+        s.jcong = seed[1];
+        s.w = seed[2] | 1;
+        s.z = seed[3] | 1;
+        out[i] = zig_nfix ( &s, hz, iz );
+      }
+    }
+  }
+  return;
 }
 /******************************************************************************/
 
@@ -645,6 +790,11 @@ void r4_nor_setup ( )
 
     R4_NOR_SETUP sets data needed by R4_NOR.
 
+  Discussion:
+
+    The tables are generated at build time by ziggurat_gen.c now, so there
+    is nothing left to do.  Kept for compatibility.
+
   Licensing:
 
     This code is distributed under the GNU LGPL license.
@@ -677,34 +827,6 @@ void r4_nor_setup ( )
     Global, float FN[128], WN[128], data needed by R4_NOR.
 */
 {
-  double dn = 3.442619855899;
-  int i;
-  const double m1 = 2147483648.0;
-  double q;
-  double tn = 3.442619855899;
-  const double vn = 9.91256303526217e-03;
-/*
-  Set up the tables for the normal random number generator.
-*/
-  q = vn / exp ( - 0.5 * dn * dn );
-
-  kn[0] = ( uint32_t ) ( ( dn / q ) * m1 );
-  kn[1] = 0;
-
-  wn[0] = ( float ) ( q / m1 );
-  wn[127] = ( float ) ( dn / m1 );
-
-  fn[0] = 1.0;
-  fn[127] = ( float ) exp ( - 0.5 * dn * dn );
-
-  for ( i = 126; 1 <= i; i-- )
-  {
-    dn = sqrt ( - 2.0 * log ( vn / dn + exp ( - 0.5 * dn * dn ) ) );
-    kn[i+1] = ( uint32_t ) ( ( dn / tn ) * m1 );
-    tn = dn;
-    fn[i] = ( float ) exp ( - 0.5 * dn * dn );
-    wn[i] = ( float ) ( dn / m1 );
-  }
   return;
 }
 /******************************************************************************/
@@ -724,8 +846,8 @@ float r4_nor_value ( )
 
     The underlying algorithm is the ziggurat method.
 
-    Before calling this function, the user must call ZIGSET, supplying
-    a nonzero seed.
+    This function uses internally managed seeds, which can be set by
+    ZIGSET.  ZIG_EXP and ZIG_NOR are the reentrant versions.
 
   Licensing:
 
@@ -757,7 +879,7 @@ float r4_nor_value ( )
     Output, float R4_NOR_VALUE, a normally distributed random value.
 */
 {
-  return RNOR;
+  return zig_nor ( &zig_default );
 }
 /******************************************************************************/
 
@@ -805,7 +927,7 @@ float r4_uni_value ( )
     the range [0,1].
 */
 {
-  return UNI;
+  return zig_uni ( &zig_default );
 }
 /******************************************************************************/
 
@@ -911,7 +1033,7 @@ uint32_t shr3_value ( )
     Output, uint32_t SHR3_VALUE, the value of the SHR3 generator.
 */
 {
-  return SHR3;
+  return shr3_seeded ( &zig_default.jsr );
 }
 /******************************************************************************/
 
@@ -1003,10 +1125,10 @@ void zigget ( uint32_t *jsr_value, uint32_t *jcong_value,
     Output, uint32_t *Z_VALUE, the seed for the second MWC generator.
 */
 {
-  *jsr_value = jsr;
-  *jcong_value = jcong;
-  *w_value = w;
-  *z_value = z;
+  *jsr_value = zig_default.jsr;
+  *jcong_value = zig_default.jcong;
+  *w_value = zig_default.w;
+  *z_value = zig_default.z;
 
   return;
 }
@@ -1019,12 +1141,12 @@ void zigset ( uint32_t jsr_value, uint32_t jcong_value,
 /*
   Purpose:
 
-    ZIGSET sets the seeds and creates the tables for the Ziggurat method.
+    ZIGSET sets the seeds of the functions that don't take a state.
 
   Discussion:
 
-    ZIGSET must be called before the exponential and normal random number
-    generators are called.
+    The tables for the Ziggurat method are built in, ZIGSET only needs to
+    be called to choose the seeds.
 
   Licensing:
 
@@ -1062,18 +1184,176 @@ void zigset ( uint32_t jsr_value, uint32_t jcong_value,
     Input, uint32_t Z_VALUE, the seed for the second MWC generator.
 */
 {
-  jsr = jsr_value;
-  jcong = jcong_value;
-  w = w_value;
-  z = z_value;
+  zig_default.jsr = jsr_value;
+  zig_default.jcong = jcong_value;
+  zig_default.w = w_value;
+  zig_default.z = z_value;
+
+  return;
+}
+/******************************************************************************/
+
+float zig_exp ( zig_state *s )
+
+/******************************************************************************/
 /*
-  Set up the tables for the normal random number generator.
+  Purpose:
+
+    ZIG_EXP returns an exponentially distributed float.
+
+  Discussion:
+
+    R4_EXP_VALUE on the state S.
+
+  Parameters:
+
+    Input/output, zig_state *S, the state.
+
+    Output, float ZIG_EXP, an exponentially distributed random value.
 */
-  r4_nor_setup ( );
-/* 
-  Set up tables for the exponential random number generator.
+{
+  uint32_t jz = zig_kiss ( s );
+  uint32_t iz = ( jz & 255 );
+
+  return ( jz < ke[iz] ) ? jz * we[iz] : zig_efix ( s, jz, iz );
+}
+/******************************************************************************/
+
+uint32_t zig_kiss ( zig_state *s )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    ZIG_KISS evaluates the KISS generator on the state S.
+
+  Parameters:
+
+    Input/output, zig_state *S, the state.
+
+    Output, uint32_t ZIG_KISS, the new value.
+*/
+{
+  uint32_t jz = s->jsr;
+
+  s->jsr ^= ( s->jsr << 13 );
+  s->jsr ^= ( s->jsr >> 17 );
+  s->jsr ^= ( s->jsr <<  5 );
+  s->z = 36969 * ( s->z & 65535 ) + ( s->z >> 16 );
+  s->w = 18000 * ( s->w & 65535 ) + ( s->w >> 16 );
+  s->jcong = 69069 * s->jcong + 1234567;
+
+  return ( ( ( s->z << 16 ) + s->w ) ^ s->jcong ) + ( jz + s->jsr );
+}
+/******************************************************************************/
+
+float zig_nor ( zig_state *s )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    ZIG_NOR returns a normally distributed float.
+
+  Discussion:
+
+    R4_NOR_VALUE on the state S.  R4_NOR_CTR_FILL is faster for many
+    values, and they don't depend on the order in which they are drawn.
+
+  Parameters:
+
+    Input/output, zig_state *S, the state.
+
+    Output, float ZIG_NOR, a normally distributed random value.
+*/
+{
+  int32_t hz = ( int32_t ) zig_kiss ( s );
+  uint32_t iz = ( hz & 127 );
+
+  return ( zig_abs ( hz ) < kn[iz] ) ? hz * wn[iz] : zig_nfix ( s, hz, iz );
+}
+/******************************************************************************/
+
+void zig_seed ( zig_state *s, uint32_t seed )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    ZIG_SEED seeds a state.
+
+  Discussion:
+
+    The seeds are derived from SEED through SHR3 and CONG steps, so nearby
+    seeds still give unrelated states.
+
+  Parameters:
+
+    Output, zig_state *S, the state.
+
+    Input, uint32_t SEED, the seed.
+*/
+{
+  uint32_t x = seed ^ 0x9e3779b9;
+
+  x = shr3_seeded ( &x ) | 1;
+  s->jsr = x;
+  x = cong_seeded ( &x );
+  s->jcong = x;
+  x = shr3_seeded ( &x ) | 1;
+  s->w = x;
+  x = shr3_seeded ( &x ) | 1;
+  s->z = x;
+
+  return;
+}
+/******************************************************************************/
+
+void zig_split ( const zig_state *s, zig_state *out, uint32_t stream )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    ZIG_SPLIT derives the state of a substream.
+
+  Discussion:
+
+    Every STREAM gives a different seed for OUT, and S is not advanced, so
+    e.g. a thread per band can split its state off a frame's with the band
+    number.
+
+  Parameters:
+
+    Input, const zig_state *S, the parent state.
+
+    Output, zig_state *OUT, the state of the substream.
+
+    Input, uint32_t STREAM, the number of the substream.
 */
-  r4_exp_setup ( );
+{
+  zig_state t = *s;
+
+  zig_seed ( out, zig_kiss ( &t ) ^ ( stream * 0x9e3779b9 ) );
 
   return;
 }
+/******************************************************************************/
+
+float zig_uni ( zig_state *s )
+
+/******************************************************************************/
+/*
+  Purpose:
+
+    ZIG_UNI returns a uniformly distributed float in [0,1].
+
+  Parameters:
+
+    Input/output, zig_state *S, the state.
+
+    Output, float ZIG_UNI, a uniformly distributed random value.
+*/
+{
+  return 0.5 + ( signed ) zig_kiss ( s ) * 0.2328306e-09;
+}
@@ -1,11 +1,27 @@
 // Provided via:
 //  https://people.sc.fsu.edu/~jburkardt/c_src/ziggurat_inline/ziggurat_inline.html
 //
+#ifndef ZIGGURAT_INLINE_H
+#define ZIGGURAT_INLINE_H
+
+#include <stdint.h>
+
+// State of a KISS generator. The zig_* functions only use the state they
+// are given, so every thread can have its own.
+typedef struct zig_state {
+  uint32_t jsr;
+  uint32_t jcong;
+  uint32_t w;
+  uint32_t z;
+} zig_state;
+
 uint32_t cong_seeded ( uint32_t *jcong );
 uint32_t cong_value ( );
 
 double cpu_time ( );
-float efix ( );
+
+// Philox4x32-10, a counter-based generator: OUT only depends on KEY and CTR.
+void philox4x32 ( const uint32_t key[2], const uint32_t ctr[4], uint32_t out[4] );
 
 uint32_t kiss_seeded ( uint32_t *jcong, uint32_t *jsr, uint32_t *w, uint32_t *z );
 uint32_t kiss_value ( );
@@ -13,9 +29,10 @@ uint32_t kiss_value ( );
 uint32_t mwc_seeded ( uint32_t *w, uint32_t *z );
 uint32_t mwc_value ( );
 
-float nfix ( );
 void r4_exp_setup ( );
 float r4_exp_value ( );
+void r4_nor_ctr_fill ( const uint32_t key[2], uint32_t c1, uint32_t c2,
+  uint32_t first, float *out, int n );
 void r4_nor_setup ( );
 float r4_nor_value ( );
 float r4_uni_value ( );
@@ -30,3 +47,13 @@ void zigget ( uint32_t *jsr_value, uint32_t *jcong_value,
 void zigset ( uint32_t jsr_value, uint32_t jcong_value,
   uint32_t w_value, uint32_t z_value );
 
+// Reentrant versions of kiss_value(), r4_uni_value(), r4_nor_value() and
+// r4_exp_value(). The tables are const, so nothing needs to be set up.
+void zig_seed ( zig_state *s, uint32_t seed );
+void zig_split ( const zig_state *s, zig_state *out, uint32_t stream );
+uint32_t zig_kiss ( zig_state *s );
+float zig_uni ( zig_state *s );
+float zig_nor ( zig_state *s );
+float zig_exp ( zig_state *s );
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ * MIT/X Consortium License, see LICENSE.
+ */
+
+#include "kernel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNEL_X86
+#endif
+
+/* pixels are stored in (b, g, r, a) order in memory */
+#define MASK_RA 0xffff0000u
+#define MASK_G  0x0000ff00u
+#define MASK_B  0x000000ffu
+
+// brighten the color safely, i.e., by simultaneously reducing contrast
+static inline uint32_t
+brighten(uint32_t c, uint32_t add) {
+    return c - c*add/255 + add;
+}
+
+/* the pixels [x0, n) of split_scalar(), also the tail of the SIMD kernels */
+static inline void
+split_range(uint32_t *dst, const uint32_t *src,
+            const int32_t *ir, const int32_t *ig, const int32_t *ib,
+            int x0, int n, uint32_t add) {
+    for (int x = x0; x < n; x++) {
+        uint32_t ra = src[ir[x]];
+        uint32_t g = src[ig ? ig[x] : x];
+        uint32_t b = src[ib[x]];
+
+        dst[x] = (ra & 0xff000000u) |
+                 brighten(ra >> 16 & 0xff, add) << 16 |
+                 brighten(g >> 8 & 0xff, add) << 8 |
+                 brighten(b & 0xff, add);
+    }
+}
+
+void
+split_scalar(uint32_t *dst, const uint32_t *src,
+             const int32_t *ir, const int32_t *ig, const int32_t *ib,
+             int n, uint8_t add) {
+    split_range(dst, src, ir, ig, ib, 0, n, add);
+}
+
+void
+gather_scalar(uint32_t *dst, const uint32_t *src, const int32_t *idx, int n) {
+    for (int x = 0; x < n; x++)
+        dst[x] = src[idx[x]];
+}
+
+#ifdef KERNEL_X86
+
+/* c*add/255 is (x + 1 + (x >> 8)) >> 8 with x = c*add, which is exact for
+ * 8-bit c and add and fits into 16 bits. The alpha lanes of add are 0, which
+ * leaves alpha as it is. */
+__attribute__((target("sse2")))
+static inline __m128i
+brighten_sse2(__m128i px, __m128i add16) {
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi16(1);
+    __m128i lo = _mm_unpacklo_epi8(px, zero);
+    __m128i hi = _mm_unpackhi_epi8(px, zero);
+    __m128i xlo = _mm_mullo_epi16(lo, add16);
+    __m128i xhi = _mm_mullo_epi16(hi, add16);
+
+    xlo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(xlo, one), _mm_srli_epi16(xlo, 8)), 8);
+    xhi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(xhi, one), _mm_srli_epi16(xhi, 8)), 8);
+    lo = _mm_add_epi16(_mm_sub_epi16(lo, xlo), add16);
+    hi = _mm_add_epi16(_mm_sub_epi16(hi, xhi), add16);
+    return _mm_packus_epi16(lo, hi);
+}
+
+/* SSE2 has no gathers, the pixels are loaded one by one and merged with
+ * masks instead of per-byte loads */
+__attribute__((target("sse2")))
+void
+split_sse2(uint32_t *dst, const uint32_t *src,
+           const int32_t *ir, const int32_t *ig, const int32_t *ib,
+           int n, uint8_t add) {
+    __m128i add16 = _mm_set_epi16(0, add, add, add, 0, add, add, add);
+    __m128i mra = _mm_set1_epi32((int)MASK_RA);
+    __m128i mg = _mm_set1_epi32(MASK_G);
+    __m128i mb = _mm_set1_epi32(MASK_B);
+    int x = 0;
+
+    for (; x + 4 <= n; x += 4) {
+        __m128i ra = _mm_set_epi32((int)src[ir[x+3]], (int)src[ir[x+2]],
+                                   (int)src[ir[x+1]], (int)src[ir[x]]);
+        __m128i b = _mm_set_epi32((int)src[ib[x+3]], (int)src[ib[x+2]],
+                                  (int)src[ib[x+1]], (int)src[ib[x]]);
+        __m128i g = ig ? _mm_set_epi32((int)src[ig[x+3]], (int)src[ig[x+2]],
+                                       (int)src[ig[x+1]], (int)src[ig[x]])
+                       : _mm_loadu_si128((const __m128i*)&src[x]);
+        __m128i px = _mm_or_si128(_mm_or_si128(_mm_and_si128(ra, mra),
+                                               _mm_and_si128(g, mg)),
+                                  _mm_and_si128(b, mb));
+
+        if (add)
+            px = brighten_sse2(px, add16);
+        _mm_storeu_si128((__m128i*)&dst[x], px);
+    }
+
+    split_range(dst, src, ir, ig, ib, x, n, add);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+brighten_avx2(__m256i px, __m256i add16) {
+    __m256i zero = _mm256_setzero_si256();
+    __m256i one = _mm256_set1_epi16(1);
+    __m256i lo = _mm256_unpacklo_epi8(px, zero);
+    __m256i hi = _mm256_unpackhi_epi8(px, zero);
+    __m256i xlo = _mm256_mullo_epi16(lo, add16);
+    __m256i xhi = _mm256_mullo_epi16(hi, add16);
+
+    xlo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(xlo, one), _mm256_srli_epi16(xlo, 8)), 8);
+    xhi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(xhi, one), _mm256_srli_epi16(xhi, 8)), 8);
+    lo = _mm256_add_epi16(_mm256_sub_epi16(lo, xlo), add16);
+    hi = _mm256_add_epi16(_mm256_sub_epi16(hi, xhi), add16);
+    /* unpack and pack both work within 128-bit lanes, so the order is kept */
+    return _mm256_packus_epi16(lo, hi);
+}
+
+__attribute__((target("avx2")))
+void
+split_avx2(uint32_t *dst, const uint32_t *src,
+           const int32_t *ir, const int32_t *ig, const int32_t *ib,
+           int n, uint8_t add) {
+    __m256i add16 = _mm256_set_epi16(0, add, add, add, 0, add, add, add,
+                                     0, add, add, add, 0, add, add, add);
+    __m256i mra = _mm256_set1_epi32((int)MASK_RA);
+    __m256i mg = _mm256_set1_epi32(MASK_G);
+    __m256i mb = _mm256_set1_epi32(MASK_B);
+    const int *base = (const int*)src;
+    int x = 0;
+
+    for (; x + 8 <= n; x += 8) {
+        __m256i ra = _mm256_i32gather_epi32(base, _mm256_loadu_si256((const __m256i*)&ir[x]), 4);
+        __m256i b = _mm256_i32gather_epi32(base, _mm256_loadu_si256((const __m256i*)&ib[x]), 4);
+        __m256i g = ig ? _mm256_i32gather_epi32(base, _mm256_loadu_si256((const __m256i*)&ig[x]), 4)
+                       : _mm256_loadu_si256((const __m256i*)&src[x]);
+        __m256i px = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(ra, mra),
+                                                     _mm256_and_si256(g, mg)),
+                                     _mm256_and_si256(b, mb));
+
+        if (add)
+            px = brighten_avx2(px, add16);
+        _mm256_storeu_si256((__m256i*)&dst[x], px);
+    }
+
+    split_range(dst, src, ir, ig, ib, x, n, add);
+}
+
+/* there is no SSE2 version, the scalar loop is as fast without gathers */
+__attribute__((target("avx2")))
+void
+gather_avx2(uint32_t *dst, const uint32_t *src, const int32_t *idx, int n) {
+    const int *base = (const int*)src;
+    int x = 0;
+
+    for (; x + 8 <= n; x += 8) {
+        __m256i i = _mm256_loadu_si256((const __m256i*)&idx[x]);
+        _mm256_storeu_si256((__m256i*)&dst[x], _mm256_i32gather_epi32(base, i, 4));
+    }
+    for (; x < n; x++)
+        dst[x] = src[idx[x]];
+}
+
+#endif
+
+int
+kernel_supported(EffectImpl impl) {
+    switch (impl) {
+        case EFFECT_SCALAR:
+            return 1;
+#ifdef KERNEL_X86
+        case EFFECT_SSE2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2");
+        case EFFECT_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return 0;
+    }
+}
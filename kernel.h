@@ -0,0 +1,43 @@
+/*
+ * Per-row kernels of the effect. The scalar versions are the reference; the
+ * SSE2 and AVX2 versions must give exactly the same pixels.
+ */
+
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include <stdint.h>
+
+#include "effect.h"
+
+/* Builds dst[x] from the red and alpha of src[ir[x]], the green of src[ig[x]]
+ * and the blue of src[ib[x]], and brightens the colors by add. ig may be NULL
+ * to take the green from src[x]. The indices must be in [0, n). */
+typedef void (*SplitFunc)(uint32_t *dst, const uint32_t *src,
+                          const int32_t *ir, const int32_t *ig, const int32_t *ib,
+                          int n, uint8_t add);
+
+void split_scalar(uint32_t *dst, const uint32_t *src,
+                  const int32_t *ir, const int32_t *ig, const int32_t *ib,
+                  int n, uint8_t add);
+#if defined(__x86_64__) || defined(__i386__)
+void split_sse2(uint32_t *dst, const uint32_t *src,
+                const int32_t *ir, const int32_t *ig, const int32_t *ib,
+                int n, uint8_t add);
+void split_avx2(uint32_t *dst, const uint32_t *src,
+                const int32_t *ir, const int32_t *ig, const int32_t *ib,
+                int n, uint8_t add);
+#endif
+
+/* dst[x] = src[idx[x]] for x in [0, n) */
+typedef void (*GatherFunc)(uint32_t *dst, const uint32_t *src, const int32_t *idx, int n);
+
+void gather_scalar(uint32_t *dst, const uint32_t *src, const int32_t *idx, int n);
+#if defined(__x86_64__) || defined(__i386__)
+void gather_avx2(uint32_t *dst, const uint32_t *src, const int32_t *idx, int n);
+#endif
+
+/* whether this build and CPU can run the kernels of impl */
+int kernel_supported(EffectImpl impl);
+
+#endif
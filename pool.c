@@ -0,0 +1,140 @@
+/*
+ * MIT/X Consortium License, see LICENSE.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>     // sysconf()
+
+#include "pool.h"
+
+struct Pool {
+    pthread_mutex_t lock;
+    pthread_cond_t work;    // signalled when a new batch is posted or on quit
+    pthread_cond_t done;    // signalled when the last index of a batch finishes
+
+    pthread_t *threads;
+    int nthreads;           // including the thread calling pool_run()
+
+    PoolFunc fn;
+    void *arg;
+    int count;              // indices in the current batch
+    int next;               // next index to hand out
+    int remaining;          // indices not yet finished
+    int quit;
+};
+
+/* Takes indices from the current batch until it is exhausted. Called with the
+ * lock held, returns with the lock held. */
+static void
+pool_drain(Pool *pool) {
+    while (pool->next < pool->count) {
+        PoolFunc fn = pool->fn;
+        void *arg = pool->arg;
+        int index = pool->next++;
+
+        pthread_mutex_unlock(&pool->lock);
+        fn(arg, index);
+        pthread_mutex_lock(&pool->lock);
+
+        if (--pool->remaining == 0)
+            pthread_cond_signal(&pool->done);
+    }
+}
+
+static void *
+pool_worker(void *data) {
+    Pool *pool = data;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->quit && pool->next >= pool->count)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->quit)
+            break;
+        pool_drain(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+Pool *
+pool_create(int nthreads) {
+    Pool *pool = calloc(1, sizeof(Pool));
+    if (!pool)
+        return NULL;
+
+    if (nthreads < 1)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1)
+        nthreads = 1;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    pool->nthreads = 1;
+    pool->threads = calloc(nthreads, sizeof(pthread_t));
+    if (!pool->threads)
+        return pool;
+
+    /* the caller is thread 0; if a worker cannot be started we simply run
+     * with fewer threads */
+    while (pool->nthreads < nthreads &&
+           pthread_create(&pool->threads[pool->nthreads], NULL, pool_worker, pool) == 0)
+        pool->nthreads++;
+
+    return pool;
+}
+
+void
+pool_destroy(Pool *pool) {
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 1; i < pool->nthreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+int
+pool_size(const Pool *pool) {
+    return pool ? pool->nthreads : 1;
+}
+
+void
+pool_run(Pool *pool, PoolFunc fn, void *arg, int count) {
+    if (!pool || pool->nthreads == 1) {
+        for (int i = 0; i < count; i++)
+            fn(arg, i);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->count = count;
+    pool->next = 0;
+    pool->remaining = count;
+    pthread_cond_broadcast(&pool->work);
+
+    pool_drain(pool);
+    while (pool->remaining > 0)
+        pthread_cond_wait(&pool->done, &pool->lock);
+
+    /* park the workers until the next batch */
+    pool->count = 0;
+    pool->next = 0;
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,21 @@
+/*
+ * Minimal fixed-size thread pool.
+ *
+ * pool_run() hands out the indices [0, count) to the pool's threads and to
+ * the calling thread, and returns once every index has been processed. Only
+ * one thread may be inside pool_run() on a given pool at a time.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+typedef struct Pool Pool;
+typedef void (*PoolFunc)(void *arg, int index);
+
+/* nthreads counts the calling thread; values < 1 mean one per online CPU */
+Pool *pool_create(int nthreads);
+void pool_destroy(Pool *pool);
+int pool_size(const Pool *pool);
+void pool_run(Pool *pool, PoolFunc fn, void *arg, int count);
+
+#endif
@@ -37,17 +37,29 @@
 #include <getopt.h>     // getopt_long()
 #include <unistd.h>
 #include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/mman.h>   // mlock()
+#include <sys/stat.h>   // umask()
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>    // shmget(), shmat()
 #include <X11/keysym.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include <X11/extensions/dpms.h>
 #include <X11/extensions/Xrandr.h>
 #include <X11/extensions/Xdbe.h>
+#include <X11/extensions/XShm.h>
 #include <security/pam_appl.h>
-#include <giblib/giblib.h>
 
-#include "ziggurat_inline.h"
+#include "effect.h"
+#include "trace.h"
 
 #ifdef __GNUC__
     #define UNUSED(x) UNUSED_ ## x __attribute__((__unused__))
@@ -61,13 +73,84 @@ typedef struct Dpms {
     CARD16 standby, suspend, off;
 } Dpms;
 
+/* A screen capture. With MIT-SHM the image lives in a segment shared with the
+ * server, so it is filled without going through the X socket. */
+typedef struct Capture {
+    XImage *img;
+    XShmSegmentInfo shminfo;
+    Bool shm;
+    int x, y;       // where the last capture was taken
+    int state;      // see below
+    uint32_t *raw;  // the capture before the effect, to animate it and to
+                    // fill the monitors that change while locked
+} Capture;
+
+/* states of a capture, the worker changes them only while it owns it */
+enum {
+    CAPTURE_GRABBED,    // the effect is still to be done
+    CAPTURE_DONE,       // corrupted, not shown yet
+    CAPTURE_SHOWN,
+};
+
+/* states of the lock screen, see main_loop() */
+typedef enum LockState {
+    STATE_INPUT,        // waiting for the password
+    STATE_VERIFYING,    // an attempt is running on the authentication worker
+    STATE_FAILED,       // showing 'authentication failed'
+    STATE_SLEEP,        // monitors forced off with Escape
+} LockState;
+
+/* event sources of the main loop */
+enum {
+    SOURCE_X,
+    SOURCE_TIMER,
+    SOURCE_SIGNAL,
+    SOURCE_AUTH,
+    SOURCE_TRIGGER,
+    SOURCE_EFFECT,
+};
+
+/* at most this many monitors are captured, one per CRTC */
+#define MAX_OUTPUTS 16
+
+/* The lock UI of one output: the username, the line and the password are
+ * centered on it, over a dimmed copy of the frame behind them. */
+typedef struct Panel {
+    int base_x, base_y;     // middle of the line
+    int line_width;
+    Pixmap backdrop;        // kept on the server, redraws only copy it
+    int bd_x, bd_y, bd_width, bd_height;
+} Panel;
+
 typedef struct WindowPositionInfo {
     int display_width, display_height;
     int output_x, output_y;
     int output_width, output_height;
+    int ncrtcs;                     // the CRTCs showing something, without clones
+    XRectangle crtcs[MAX_OUTPUTS];
 } WindowPositionInfo;
 
+/* Everything that is set up once. In daemon mode it is kept across locks, so
+ * a lock only has to capture, grab and map. */
+typedef struct LockContext {
+    int screen_num;
+    Window root, w;
+    Visual *vis;
+    Cursor invisible;
+    XColor black, red, white;
+    XFontStruct *font;
+    GC gc;
+    char passdisp[256];
+    WindowPositionInfo info;
+    Capture caps[MAX_OUTPUTS];  // one per monitor, the root outside them is not shown
+    int ncaps;
+    Pool *pool;
+    EffectField *fields[MAX_OUTPUTS];   // with -s, the effect is the same on every lock
+} LockContext;
+
 static int conv_callback(int num_msgs, const struct pam_message **msg, struct pam_response **resp, void *appdata_ptr);
+static void outputs_changed(LockContext *ctx);
+static void outputs_apply(LockContext *ctx);
 
 /* command-line arguments */
 static char* opt_font;
@@ -75,6 +158,13 @@ static char* opt_username;
 static char* opt_passchar;
 static Bool  opt_hidelength;
 static Bool  opt_primary;
+static int   opt_threads;
+static Bool  opt_daemon;
+static Bool  opt_trigger;
+static char* opt_trace;
+static Bool  opt_seeded;
+static unsigned long opt_seed;
+static int   opt_fps;
 
 /* need globals for signal handling */
 Display *dpy;
@@ -82,12 +172,26 @@ Dpms dpms_original = { .state = True, .level = 0, .standby = 600, .suspend = 600
 int dpms_timeout = 10;  // dpms timeout until program exits
 Bool using_dpms;
 
+int failed_timeout = 3000;  // ms until 'authentication failed' is cleared
+int sleep_delay = 250;      // ms between Escape and forcing the monitors off
+
+/* INT, HUP and TERM (and USR1 in daemon mode) are blocked and read from
+ * here by the main loop */
+static int signal_fd = -1;
+static int caught_signal;
+
+/* daemon mode: listening socket, and clients waiting for the screen to be
+ * covered */
+static int trigger_fd = -1;
+static int trigger_clients[16];
+static int trigger_nclients;
+
 XdbeBackBuffer bb;
-static XImage *bd_img;
-static int backdrop_width,
-           backdrop_height,
-           backdrop_x,
-           backdrop_y;
+static Pixmap bg_pix = None;
+
+/* one panel per output, they share the window, the GC and the font */
+static Panel panels[MAX_OUTPUTS];
+static int npanels;
 
 pam_handle_t *pam_handle;
 struct pam_conv conv = { conv_callback, NULL };
@@ -95,6 +199,63 @@ struct pam_conv conv = { conv_callback, NULL };
 /* Holds the password you enter */
 static char password[256];
 
+/* Holds the password being verified, so that typing can go on meanwhile */
+static char auth_password[256];
+
+/* Attempts submitted with Return while another one is verified, oldest
+ * first. Each is the password as it was at that Return. */
+#define MAX_QUEUED 4
+static char queued_password[MAX_QUEUED][256];
+static unsigned int queued_len[MAX_QUEUED];
+static int nqueued;
+
+/* PAM runs on a worker thread, the event loop learns about finished attempts
+ * through a pipe */
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    Bool pending;   // an attempt was submitted and not yet picked up
+    int result;     // return value of the last pam_authenticate()
+    int fd[2];      // a byte is written to fd[1] whenever an attempt finishes
+} auth = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+/* The effect is computed on a worker thread while the lock screen already
+ * shows the dimmed captures; the main loop swaps it in once it is done. In
+ * animated mode the worker goes on rendering frames, each handed over the
+ * same way. The worker owns the captures unless busy is set. */
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;    // signalled when busy is cleared or on stop
+    Bool running;           // started and not yet joined
+    Bool stop;              // asks the worker to end
+    Bool captured;          // the capture may be used
+    Bool ready;             // a frame waits for the main loop
+    Bool busy;              // the main loop still has the last frame
+    Bool animate;           // every capture has its raw copy
+    Bool done;              // the worker has ended, or is about to
+    LockContext *ctx;
+    uint32_t seed;
+    int cap;                // the capture changed by the last frame, -1 for all
+    int row, rows;          // and its rows
+    int uploads;            // shm_completion events until busy is cleared
+    int fd[2];              // a byte is written to fd[1] for every frame
+} effect_job = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER, .fd = { -1, -1 } };
+
+/* the event the server sends when it is done reading a shared capture */
+static int shm_completion = -1;
+
+/* the first RandR event, the monitors are followed while locked */
+static int rr_event_base = -1;
+
+/* A change of the monitors while locked waits for the effect worker to give
+ * the captures back, see outputs_changed(). */
+static struct {
+    Bool pending;
+    int width, height;      // the size of the cover before the change
+} relayout;
+
 static void
 die(const char *errstr, ...) {
     va_list ap;
@@ -102,6 +263,7 @@ die(const char *errstr, ...) {
     fprintf(stderr, "%s: ", PROGNAME);
     vfprintf(stderr, errstr, ap);
     va_end(ap);
+    trace_close();
     exit(EXIT_FAILURE);
 }
 
@@ -111,13 +273,20 @@ die(const char *errstr, ...) {
  *
  */
 static void
-clear_password_memory(void) {
+clear_memory(char *buf, size_t size) {
     /* A volatile pointer to the password buffer to prevent the compiler from
      * optimizing this out. */
-    volatile char *vpassword = password;
-    for (unsigned int c = 0; c < sizeof(password); c++)
+    volatile char *vbuf = buf;
+    for (unsigned int c = 0; c < size; c++)
         /* rewrite with random values */
-        vpassword[c] = rand();
+        vbuf[c] = rand();
+}
+
+static void
+clear_password_memory(void) {
+    clear_memory(password, sizeof(password));
+    clear_memory((char*)queued_password, sizeof(queued_password));
+    nqueued = 0;
 }
 
 /*
@@ -140,7 +309,7 @@ conv_callback(int num_msgs, const struct pam_message **msg, struct pam_response
 
         // return code is currently not used but should be set to zero
         resp[i]->resp_retcode = 0;
-        if ((resp[i]->resp = strdup(password)) == NULL) {
+        if ((resp[i]->resp = strdup(auth_password)) == NULL) {
             free(*resp);
             return PAM_BUF_ERR;
         }
@@ -149,45 +318,707 @@ conv_callback(int num_msgs, const struct pam_message **msg, struct pam_response
     return PAM_SUCCESS;
 }
 
-void
-handle_signal(int sig) {
-    /* restore dpms settings */
-    if (using_dpms) {
-        DPMSSetTimeouts(dpy, dpms_original.standby, dpms_original.suspend, dpms_original.off);
-        if (!dpms_original.state)
-            DPMSDisable(dpy);
+static void *
+auth_worker(void *UNUSED(arg)) {
+    pthread_mutex_lock(&auth.lock);
+    for (;;) {
+        while (!auth.pending)
+            pthread_cond_wait(&auth.cond, &auth.lock);
+        pthread_mutex_unlock(&auth.lock);
+
+        /* this may block for seconds, e.g. in pam_faildelay */
+        int ret = pam_authenticate(pam_handle, 0);
+        clear_memory(auth_password, sizeof(auth_password));
+
+        pthread_mutex_lock(&auth.lock);
+        auth.result = ret;
+        auth.pending = False;
+        while (write(auth.fd[1], "", 1) < 0 && errno == EINTR)
+            ;
+    }
+    return NULL;
+}
+
+/* Creates a pipe for a worker to wake up the event loop; the read end
+ * doesn't block. */
+static void
+wakeup_pipe(int fd[2]) {
+    if (pipe(fd) != 0)
+        die("cannot create pipe: %s\n", strerror(errno));
+    fcntl(fd[0], F_SETFL, O_NONBLOCK);
+    fcntl(fd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fd[1], F_SETFD, FD_CLOEXEC);
+}
+
+/* Empties the read end of a wakeup pipe. */
+static void
+wakeup_drain(int fd) {
+    char buf[16];
+    while (read(fd, buf, sizeof(buf)) > 0)
+        ;
+}
+
+/* Starts a worker thread, signals are left to the main thread. */
+static int
+worker_create(pthread_t *thread, void *(*fn)(void *)) {
+    sigset_t set, old;
+    sigfillset(&set);
+    pthread_sigmask(SIG_SETMASK, &set, &old);
+    int ret = pthread_create(thread, NULL, fn, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return ret;
+}
+
+/* Starts the authentication worker, pam_handle must be set up. */
+static void
+auth_start(void) {
+    wakeup_pipe(auth.fd);
+    int ret = worker_create(&auth.thread, auth_worker);
+    if (ret != 0)
+        die("cannot start authentication thread: %s\n", strerror(ret));
+}
+
+/* Hands the first len characters of buf to the worker. */
+static void
+auth_submit(const char *buf, unsigned int len) {
+    pthread_mutex_lock(&auth.lock);
+    memcpy(auth_password, buf, len);
+    auth_password[len] = 0;
+    auth.pending = True;
+    pthread_cond_signal(&auth.cond);
+    pthread_mutex_unlock(&auth.lock);
+}
+
+/* Keeps the first len characters of password as an attempt for when the
+ * running one fails. When too many wait, the newest one is replaced. */
+static void
+auth_queue(unsigned int len) {
+    if (nqueued == MAX_QUEUED)
+        nqueued--;
+    memcpy(queued_password[nqueued], password, len);
+    queued_len[nqueued++] = len;
+}
+
+/* Submits the oldest queued attempt and forgets it. */
+static void
+auth_submit_queued(void) {
+    auth_submit(queued_password[0], queued_len[0]);
+    for (int i = 1; i < nqueued; i++) {
+        memcpy(queued_password[i-1], queued_password[i], queued_len[i]);
+        queued_len[i-1] = queued_len[i];
+    }
+    nqueued--;
+    clear_memory(queued_password[nqueued], sizeof(queued_password[nqueued]));
+}
+
+/* Returns the result of the attempt that just finished. */
+static int
+auth_result(void) {
+    wakeup_drain(auth.fd[0]);
+    pthread_mutex_lock(&auth.lock);
+    int ret = auth.result;
+    pthread_mutex_unlock(&auth.lock);
+    return ret;
+}
+
+static Bool shm_failed;
+
+static int
+shm_error_handler(Display *UNUSED(d), XErrorEvent *UNUSED(e)) {
+    shm_failed = True;
+    return 0;
+}
+
+/*
+ * Sets up a width x height capture image, in shared memory if possible. The
+ * SHM extension may be present but unusable, e.g. on remote displays, so the
+ * attach is checked for errors before relying on it.
+ */
+static void
+capture_create(Capture *cap, Visual *vis, int depth, int width, int height) {
+    memset(cap, 0, sizeof(*cap));
+
+    if (XShmQueryExtension(dpy)) {
+        cap->img = XShmCreateImage(dpy, vis, depth, ZPixmap, NULL, &cap->shminfo, width, height);
+        if (cap->img) {
+            cap->shminfo.shmid = shmget(IPC_PRIVATE, cap->img->bytes_per_line * cap->img->height, IPC_CREAT | 0600);
+            if (cap->shminfo.shmid != -1) {
+                cap->shminfo.shmaddr = cap->img->data = shmat(cap->shminfo.shmid, NULL, 0);
+                cap->shminfo.readOnly = False;
+
+                if (cap->shminfo.shmaddr != (char*)-1) {
+                    XErrorHandler old_handler = XSetErrorHandler(shm_error_handler);
+                    shm_failed = False;
+                    XShmAttach(dpy, &cap->shminfo);
+                    XSync(dpy, False);
+                    XSetErrorHandler(old_handler);
+
+                    if (!shm_failed) {
+                        cap->shm = True;
+                        shm_completion = XShmGetEventBase(dpy) + ShmCompletion;
+                    }
+                    else
+                        shmdt(cap->shminfo.shmaddr);
+                }
+                /* the segment goes away once both sides have detached */
+                shmctl(cap->shminfo.shmid, IPC_RMID, NULL);
+            }
+            if (!cap->shm) {
+                cap->img->data = NULL;
+                XDestroyImage(cap->img);
+                cap->img = NULL;
+            }
+        }
+    }
+
+    if (!cap->shm) {
+        char *data = malloc(4 * width * height);
+        if (!data)
+            die("cannot allocate capture image\n");
+        cap->img = XCreateImage(dpy, vis, depth, ZPixmap, 0, data, width, height, 32, 0);
     }
 
-    die("Caught signal %d; dying\n", sig);
+    /* the effect works on 32-bit BGRA pixels */
+    if (!cap->img || cap->img->bits_per_pixel != 32 || cap->img->bytes_per_line != 4 * width)
+        die("unsupported screen format, only 32 bits per pixel is supported\n");
 }
 
-Imlib_Image image;
+/* Fills the capture with the area of drawable d starting at (x, y). The
+ * caller marks it CAPTURE_GRABBED before the worker is started. */
+static void
+capture_grab(Capture *cap, Drawable d, int x, int y) {
+    cap->x = x;
+    cap->y = y;
+    if (cap->shm)
+        XShmGetImage(dpy, d, cap->img, x, y, AllPlanes);
+    else
+        XGetSubImage(dpy, d, x, y, cap->img->width, cap->img->height, AllPlanes, ZPixmap, cap->img, 0, 0);
+}
+
+/* Uploads rows [row, row + rows) of the capture to drawable d, where they
+ * were taken. With notify, a shared capture must not be changed until the
+ * server sends shm_completion; returns whether it did so. */
+static Bool
+capture_put(Capture *cap, Drawable d, GC gc, int row, int rows, Bool notify) {
+    int w = cap->img->width;
+
+    if (cap->shm) {
+        XShmPutImage(dpy, d, gc, cap->img, 0, row, cap->x, cap->y + row, w, rows, notify);
+        return notify;
+    }
+    XPutImage(dpy, d, gc, cap->img, 0, row, cap->x, cap->y + row, w, rows);
+    return False;
+}
+
+static void
+capture_destroy(Capture *cap) {
+    free(cap->raw);
+    cap->raw = NULL;
+    if (!cap->img)
+        return;
+    if (cap->shm) {
+        XShmDetach(dpy, &cap->shminfo);
+        XSync(dpy, False);
+        shmdt(cap->shminfo.shmaddr);
+        cap->img->data = NULL;
+    }
+    XDestroyImage(cap->img);
+    cap->img = NULL;
+}
+
+/* Copies the frame into the backdrops behind the text that overlap the
+ * width x height area at (x, y), dimmed unless the frame is. */
+static void
+backdrops_update(LockContext *ctx, int x, int y, int width, int height, Bool dim) {
+    int depth = DefaultDepth(dpy, ctx->screen_num);
+    GC gc = ctx->gc;
+
+    XSetForeground(dpy, gc, 0x00dbdbdb);
+    for (int i = 0; i < npanels; i++) {
+        Panel *p = &panels[i];
+        if (p->backdrop == None)
+            p->backdrop = XCreatePixmap(dpy, ctx->w, p->bd_width, p->bd_height, depth);
+        else if (p->bd_x >= x + width || p->bd_x + p->bd_width <= x ||
+                 p->bd_y >= y + height || p->bd_y + p->bd_height <= y)
+            continue;
+        XCopyArea(dpy, bg_pix, p->backdrop, gc, p->bd_x, p->bd_y, p->bd_width, p->bd_height, 0, 0);
+        if (!dim) {
+            XSetFunction(dpy, gc, GXand);
+            XFillRectangle(dpy, p->backdrop, gc, 0, 0, p->bd_width, p->bd_height);
+            XSetFunction(dpy, gc, GXcopy);
+        }
+    }
+    XSetForeground(dpy, gc, ctx->white.pixel);
+}
+
+/* Uploads rows [row, row + rows) of a capture into the window background
+ * and fills the back buffer and the backdrop behind the text from it, so the
+ * next swap shows them. With dim, the frame is dimmed like the backdrop,
+ * which is cheap as it is done by the server. Returns whether the server
+ * reports when it is done reading the capture, see capture_put(). */
+static Bool
+show_frame(LockContext *ctx, Capture *cap, int row, int rows, Bool dim, Bool notify) {
+    WindowPositionInfo *info = &ctx->info;
+    int depth = DefaultDepth(dpy, ctx->screen_num);
+    GC gc = ctx->gc;
+    uint64_t t = trace_now();
+
+    /* the background is kept, animation frames only update some rows */
+    Bool full = bg_pix == None;
+    if (full) {
+        bg_pix = XCreatePixmap(dpy, ctx->w, info->display_width, info->display_height, depth);
+        XSetForeground(dpy, gc, ctx->black.pixel);
+        XFillRectangle(dpy, bg_pix, gc, 0, 0, info->display_width, info->display_height);
+    }
+
+    /* the frame is sent to the server once, everything else is filled from
+     * the background pixmap on the server side */
+    notify = capture_put(cap, bg_pix, gc, row, rows, notify);
+    XSetFunction(dpy, gc, GXand);
+    XSetForeground(dpy, gc, 0x00dbdbdb);
+    if (dim)
+        XFillRectangle(dpy, bg_pix, gc, cap->x, cap->y + row, cap->img->width, rows);
+    XSetFunction(dpy, gc, GXcopy);
+    /* set again, the server may have copied the pixmap */
+    XSetWindowBackgroundPixmap(dpy, ctx->w, bg_pix);
+    if (full)
+        XCopyArea(dpy, bg_pix, bb, gc, 0, 0, info->display_width, info->display_height, 0, 0);
+    else
+        XCopyArea(dpy, bg_pix, bb, gc, cap->x, cap->y + row, cap->img->width, rows, cap->x, cap->y + row);
+
+    /* the backdrops behind the text are dimmed copies of the frame, only
+     * those the new rows overlap change */
+    backdrops_update(ctx, cap->x, cap->y + row, cap->img->width, rows, dim);
+
+    trace_span("frame upload", t);
+    return notify;
+}
+
+/* Hands rows [row, row + rows) of capture cap to the main loop, or all of
+ * them if cap is -1. Called with the lock held. */
+static void
+effect_ready(int cap, int row, int rows) {
+    effect_job.cap = cap;
+    effect_job.row = row;
+    effect_job.rows = rows;
+    effect_job.ready = True;
+    effect_job.busy = True;
+    while (write(effect_job.fd[1], "", 1) < 0 && errno == EINTR)
+        ;
+}
+
+/*
+ * Renders the effect on the captures that were just grabbed, and then
+ * animation frames at opt_fps.
+ * A frame restores a strip of rows of a capture from the raw ones and
+ * corrupts it again with the next seed, so the cost of a frame is set by the
+ * height of the strip. The captures take turns. The strip is halved whenever
+ * a frame misses its budget, and grows back slowly while frames take less
+ * than half of it.
+ */
+static void
+effect_run(void) {
+    LockContext *ctx = effect_job.ctx;
+    EffectFrame frames[MAX_OUTPUTS], todo[MAX_OUTPUTS];
+    int idx[MAX_OUTPUTS];   // of the captures in todo
+    uint32_t seed = effect_job.seed;
+    int n = ctx->ncaps, ntodo = 0, hmax = 0;
+
+    /* every monitor is a frame of its own, with a seed of its own; those that
+     * were shown already keep their effect */
+    for (int i = 0; i < n; i++) {
+        XImage *img = ctx->caps[i].img;
+        frames[i].data = (uint32_t*)img->data;
+        frames[i].w = img->width;
+        frames[i].h = img->height;
+        frames[i].seed = seed ^ (uint32_t)i * 0x9e3779b9;
+        if (frames[i].h > hmax)
+            hmax = frames[i].h;
+        if (ctx->caps[i].state == CAPTURE_GRABBED) {
+            idx[ntodo] = i;
+            todo[ntodo++] = frames[i];
+        }
+    }
+
+    /* With a fixed seed the displacement fields are kept, and only made again
+     * when the size changes. They are made while the screen is captured. */
+    if (opt_seeded) {
+        for (int i = n; i < MAX_OUTPUTS; i++) {
+            effect_field_free(ctx->fields[i]);
+            ctx->fields[i] = NULL;
+        }
+        for (int k = 0; k < ntodo; k++) {
+            EffectField **field = &ctx->fields[idx[k]];
+            if (*field && (effect_field_width(*field) != todo[k].w ||
+                           effect_field_height(*field) != todo[k].h)) {
+                effect_field_free(*field);
+                *field = NULL;
+            }
+            if (!*field)
+                *field = effect_field_new(todo[k].w, todo[k].h, todo[k].seed, ctx->pool);
+        }
+    }
+
+    pthread_mutex_lock(&effect_job.lock);
+    while (!effect_job.captured && !effect_job.stop)
+        pthread_cond_wait(&effect_job.cond, &effect_job.lock);
+    if (effect_job.stop) {
+        pthread_mutex_unlock(&effect_job.lock);
+        return;
+    }
+    pthread_mutex_unlock(&effect_job.lock);
+
+    uint64_t t = trace_now();
+    for (int k = 0; k < ntodo; k++) {
+        if (ctx->caps[idx[k]].raw)
+            memcpy(ctx->caps[idx[k]].raw, todo[k].data, 4 * (size_t)todo[k].w * todo[k].h);
+    }
+    if (opt_seeded) {
+        for (int k = 0; k < ntodo; k++) {
+            if (ctx->fields[idx[k]])
+                effect_field_apply(ctx->fields[idx[k]], todo[k].data, ctx->pool);
+            else
+                corrupt_it(todo[k].data, todo[k].w, todo[k].h, todo[k].seed, ctx->pool, NULL);
+        }
+    } else if (ntodo > 0) {
+        corrupt_frames(todo, ntodo, ctx->pool);
+    }
+    trace_span("corrupt_it", t);
+
+    pthread_mutex_lock(&effect_job.lock);
+    for (int k = 0; k < ntodo; k++)
+        ctx->caps[idx[k]].state = CAPTURE_DONE;
+    effect_ready(-1, 0, 0);
+    if (!effect_job.animate) {
+        pthread_mutex_unlock(&effect_job.lock);
+        return;
+    }
+
+    uint64_t budget = 1000000 / opt_fps;
+    uint64_t next = t;
+    int rows = hmax;
+    int turn = 0;
+
+    for (;;) {
+        next += budget;
+
+        /* wait for the last frame to be uploaded and for the next deadline */
+        while (!effect_job.stop) {
+            uint64_t now = trace_now();
+            if (effect_job.busy) {
+                pthread_cond_wait(&effect_job.cond, &effect_job.lock);
+            } else if (now < next) {
+                /* the condition variable waits on the realtime clock */
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                uint64_t ns = ts.tv_nsec + (next - now) * 1000;
+                ts.tv_sec += ns / 1000000000;
+                ts.tv_nsec = ns % 1000000000;
+                pthread_cond_timedwait(&effect_job.cond, &effect_job.lock, &ts);
+            } else {
+                break;
+            }
+        }
+        if (effect_job.stop)
+            break;
+        pthread_mutex_unlock(&effect_job.lock);
+
+        /* late frames don't try to catch up */
+        t = trace_now();
+        if (t > next)
+            next = t;
+
+        seed = seed * 1664525 + 1013904223;
+        int i = turn++ % n;
+        int w = frames[i].w, h = frames[i].h;
+        int strip = rows < h ? rows : h;
+        int row = (seed >> 8) % (h - strip + 1);
+        uint32_t *data = frames[i].data + (size_t)row * w;
+        memcpy(data, ctx->caps[i].raw + (size_t)row * w, 4 * (size_t)w * strip);
+        corrupt_it(data, w, strip, seed, ctx->pool, NULL);
+        uint64_t dt = trace_now() - t;
+        trace_span("animation frame", t);
+
+        pthread_mutex_lock(&effect_job.lock);
+        effect_ready(i, row, strip);
+        if (dt > budget)
+            rows = strip / 2 > 16 ? strip / 2 : (hmax < 16 ? hmax : 16);
+        else if (2 * dt < budget)
+            rows = rows + rows / 4 + 1 < hmax ? rows + rows / 4 + 1 : hmax;
+    }
+    pthread_mutex_unlock(&effect_job.lock);
+}
+
+static void *
+effect_worker(void *UNUSED(arg)) {
+    effect_run();
+
+    /* a worker that was asked to stop wakes the main loop, which may wait
+     * for the captures */
+    pthread_mutex_lock(&effect_job.lock);
+    effect_job.done = True;
+    if (effect_job.stop) {
+        while (write(effect_job.fd[1], "", 1) < 0 && errno == EINTR)
+            ;
+    }
+    pthread_mutex_unlock(&effect_job.lock);
+    return NULL;
+}
+
+/* Starts the effect worker, it waits for effect_captured() before it uses
+ * the captures. */
+static void
+effect_start(LockContext *ctx, uint32_t seed) {
+    if (effect_job.fd[0] < 0)
+        wakeup_pipe(effect_job.fd);
+
+    effect_job.ctx = ctx;
+    effect_job.seed = seed;
+    effect_job.stop = False;
+    effect_job.captured = False;
+    effect_job.ready = False;
+    effect_job.busy = False;
+    effect_job.uploads = 0;
+    effect_job.done = False;
+    effect_job.animate = opt_fps > 0;
+    for (int i = 0; i < ctx->ncaps; i++) {
+        Capture *c = &ctx->caps[i];
+        if (!c->raw && !(c->raw = malloc(4 * (size_t)c->img->width * c->img->height)) && effect_job.animate) {
+            fprintf(stderr, "cannot allocate animation buffer, not animating\n");
+            effect_job.animate = False;
+        }
+    }
+
+    int ret = worker_create(&effect_job.thread, effect_worker);
+    if (ret != 0)
+        die("cannot start effect thread: %s\n", strerror(ret));
+    effect_job.running = True;
+}
+
+/* Hands the captures to the effect worker, the server must be done with them. */
+static void
+effect_captured(void) {
+    pthread_mutex_lock(&effect_job.lock);
+    effect_job.captured = True;
+    pthread_cond_signal(&effect_job.cond);
+    pthread_mutex_unlock(&effect_job.lock);
+}
+
+/* Asks the effect worker to stop, without waiting for it. It wakes the main
+ * loop when it does, see effect_done(). */
+static void
+effect_cancel(void) {
+    pthread_mutex_lock(&effect_job.lock);
+    effect_job.stop = True;
+    pthread_cond_signal(&effect_job.cond);
+    pthread_mutex_unlock(&effect_job.lock);
+}
+
+/* Stops the effect worker and waits for it. */
+static void
+effect_stop(void) {
+    if (!effect_job.running)
+        return;
+    effect_cancel();
+    pthread_join(effect_job.thread, NULL);
+    wakeup_drain(effect_job.fd[0]);
+    effect_job.running = False;
+}
+
+/* Whether effect_stop() would return at once. */
+static Bool
+effect_done(void) {
+    pthread_mutex_lock(&effect_job.lock);
+    Bool done = !effect_job.running || effect_job.done;
+    pthread_mutex_unlock(&effect_job.lock);
+    return done;
+}
+
+/* Counts a shm_completion, the worker gets the captures back with the last
+ * one. Only the main loop uses uploads. */
+static void
+effect_release(void) {
+    if (effect_job.uploads > 0 && --effect_job.uploads > 0)
+        return;
+    pthread_mutex_lock(&effect_job.lock);
+    effect_job.busy = False;
+    pthread_cond_signal(&effect_job.cond);
+    pthread_mutex_unlock(&effect_job.lock);
+}
+
+/* Swaps a new frame in if there is one, it shows with the next buffer swap. */
+static void
+effect_finish(void) {
+    pthread_mutex_lock(&effect_job.lock);
+    Bool ready = effect_job.ready;
+    int cap = effect_job.cap, row = effect_job.row, rows = effect_job.rows;
+    effect_job.ready = False;
+    pthread_mutex_unlock(&effect_job.lock);
+    if (!ready)
+        return;
+
+    /* the worker may only go on once the server has read the capture */
+    LockContext *ctx = effect_job.ctx;
+    Bool notify = effect_job.animate;
+    if (!notify)
+        effect_stop();
+    effect_job.uploads = 0;
+    for (int i = 0; i < ctx->ncaps; i++) {
+        Capture *c = &ctx->caps[i];
+        if (cap < 0 && c->state == CAPTURE_DONE) {
+            effect_job.uploads += show_frame(ctx, c, 0, c->img->height, False, notify);
+            c->state = CAPTURE_SHOWN;
+        } else if (cap == i)
+            effect_job.uploads += show_frame(ctx, c, row, rows, False, notify);
+    }
+    if (!effect_job.uploads)
+        effect_release();
+}
+
+/* The daemon listens on $XDG_RUNTIME_DIR/sxlock<display>.sock. */
+static void
+socket_path(struct sockaddr_un *addr) {
+    const char *dir = getenv("XDG_RUNTIME_DIR");
+    const char *display = getenv("DISPLAY");
+
+    /* a world-writable fallback would let others answer in our place */
+    if (!dir)
+        die("XDG_RUNTIME_DIR is not set\n");
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/"PROGNAME"%s.sock",
+                 dir, display ? display : "") >= (int)sizeof(addr->sun_path))
+        die("socket path too long\n");
+}
+
+static void
+trigger_listen(void) {
+    struct sockaddr_un addr;
+    socket_path(&addr);
+
+    /* refuse to replace a daemon that is still alive */
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0)
+        die("another daemon is listening on %s\n", addr.sun_path);
+    if (fd >= 0)
+        close(fd);
+    unlink(addr.sun_path);
+
+    if ((trigger_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        die("socket: %s\n", strerror(errno));
+    fcntl(trigger_fd, F_SETFD, FD_CLOEXEC);
+
+    mode_t mask = umask(0077);
+    if (bind(trigger_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(trigger_fd, 4) != 0)
+        die("cannot listen on %s: %s\n", addr.sun_path, strerror(errno));
+    umask(mask);
+}
+
+/* Accepts a trigger client. If the screen is already covered it is answered
+ * right away, otherwise once lock_screen() has mapped the window. */
+static void
+trigger_accept(Bool covered) {
+    int fd = accept(trigger_fd, NULL, NULL);
+    if (fd < 0)
+        return;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    if (covered || trigger_nclients == sizeof(trigger_clients) / sizeof(trigger_clients[0])) {
+        while (send(fd, "", 1, MSG_NOSIGNAL) < 0 && errno == EINTR)
+            ;
+        close(fd);
+        return;
+    }
+    trigger_clients[trigger_nclients++] = fd;
+}
+
+/* Tells the waiting trigger clients whether the screen is covered; they see
+ * a failure as the connection closing without an answer. */
+static void
+trigger_notify(Bool covered) {
+    for (int i = 0; i < trigger_nclients; i++) {
+        while (covered && send(trigger_clients[i], "", 1, MSG_NOSIGNAL) < 0 && errno == EINTR)
+            ;
+        close(trigger_clients[i]);
+    }
+    trigger_nclients = 0;
+}
+
+/* --trigger: asks the daemon to lock, returns once the screen is covered. */
+static int
+trigger_lock(void) {
+    struct sockaddr_un addr;
+    socket_path(&addr);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+        die("no daemon listening on %s\n", addr.sun_path);
+
+    char c;
+    ssize_t n;
+    while ((n = read(fd, &c, 1)) < 0 && errno == EINTR)
+        ;
+    close(fd);
+    return n == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void
+loop_add(int epfd, int fd, uint32_t source) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = source };
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        die("epoll_ctl: %s\n", strerror(errno));
+}
+
+/* (Re)arms the one-shot timer of the main loop, 0 disarms it. */
+static void
+timer_arm(int fd, int ms) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = ms / 1000;
+    its.it_value.tv_nsec = (ms % 1000) * 1000000L;
+    timerfd_settime(fd, 0, &its, NULL);
+}
+
+/* Switches the lock screen to state next, every state owns the timer. */
+static void
+enter_state(LockState *state, LockState next, int timer_fd) {
+    *state = next;
+    switch (next) {
+        case STATE_FAILED:
+            timer_arm(timer_fd, failed_timeout);
+            break;
+        case STATE_SLEEP:
+            timer_arm(timer_fd, sleep_delay);
+            break;
+        default:
+            timer_arm(timer_fd, 0);
+            break;
+    }
+}
 
 void
-main_loop(Window w, GC gc, XFontStruct* font, WindowPositionInfo* info, char passdisp[256], char* username, XColor black, XColor white, XColor red, Bool hidelength) {
+main_loop(LockContext *ctx) {
     XEvent event;
     KeySym ksym;
 
+    Window w = ctx->w;
+    GC gc = ctx->gc;
+    XFontStruct *font = ctx->font;
+    WindowPositionInfo *info = &ctx->info;
+    char *passdisp = ctx->passdisp;
+    char *username = opt_username;
+    XColor white = ctx->white, red = ctx->red;
+    Bool hidelength = opt_hidelength;
+
     unsigned int len = 0;
     Bool running = True;
-    Bool sleepmode = False;
-    Bool failed = False;
+    Bool redraw = True;
+    Bool outputs_dirty = False;     // RandR reported a change
+    LockState state = STATE_INPUT;
 
     XSync(dpy, False);
 
-    /* define base coordinates - middle of screen */
-    int base_x = info->output_x + info->output_width / 2;
-    int base_y = info->output_y + info->output_height / 2;    /* y-position of the line */
-
-    int line_width = info->output_width / 4;
-    if (line_width > 800) {
-        line_width = 800;
-    }
-
-    /* not changed in the loop */
-    int line_x_left = base_x - line_width / 2;
-    int line_x_right = base_x + line_width / 2;
-
     /* font properties */
     int ascent, descent;
     {
@@ -205,87 +1036,237 @@ main_loop(Window w, GC gc, XFontStruct* font, WindowPositionInfo* info, char pas
         return;
     }
 
-    XClearArea(dpy, w, info->output_x, info->output_y, info->output_width, info->output_height, False);
-
-    XMapRaised(dpy, w);
+    XClearArea(dpy, w, 0, 0, info->display_width, info->display_height, False);
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epfd < 0 || timer_fd < 0)
+        die("cannot set up the event loop: %s\n", strerror(errno));
+    loop_add(epfd, ConnectionNumber(dpy), SOURCE_X);
+    loop_add(epfd, timer_fd, SOURCE_TIMER);
+    loop_add(epfd, signal_fd, SOURCE_SIGNAL);
+    loop_add(epfd, auth.fd[0], SOURCE_AUTH);
+    if (trigger_fd >= 0)
+        loop_add(epfd, trigger_fd, SOURCE_TRIGGER);
+    /* also when the effect is done, a change of the monitors restarts it */
+    loop_add(epfd, effect_job.fd[0], SOURCE_EFFECT);
 
     /* main event loop */
-    while(running && !XNextEvent(dpy, &event)) {
-        if (sleepmode && using_dpms)
-            DPMSForceLevel(dpy, DPMSModeOff);
+    while (running) {
+        /* handle everything Xlib has queued or can read without blocking */
+        while (running && XPending(dpy)) {
+            XNextEvent(dpy, &event);
+
+            switch (event.type) {
+                case MotionNotify:
+                    if (state == STATE_SLEEP || state == STATE_FAILED) {
+                        enter_state(&state, STATE_INPUT, timer_fd);
+                        redraw = True;
+                    }
+                    break;
 
-        /* update window if no events pending */
-        if (!XPending(dpy)) {
-            // draw backdrop
-            XPutImage(dpy, bb, gc, bd_img, 0, 0, backdrop_x, backdrop_y, backdrop_width, backdrop_height);
+                case KeyRelease:
+                case ButtonPress:
+                case ButtonRelease:
+                    /* this woke the monitors up without leaving sleep mode
+                     * (e.g. releasing Escape), so force them off again */
+                    if (state == STATE_SLEEP)
+                        enter_state(&state, STATE_SLEEP, timer_fd);
+                    break;
 
-            // draw username and separator
-            XSetForeground(dpy, gc, white.pixel);
-            int x = base_x - XTextWidth(font, username, strlen(username)) / 2;
-            XDrawString(dpy, bb, gc, x, base_y - 10, username, strlen(username));
-            XDrawLine(dpy, bb, gc, line_x_left, base_y, line_x_right, base_y);
+                case KeyPress: {
+                    if (state == STATE_SLEEP || state == STATE_FAILED)
+                        enter_state(&state, STATE_INPUT, timer_fd);
+                    redraw = True;
+
+                    char inputChar = 0;
+                    XLookupString(&event.xkey, &inputChar, sizeof(inputChar), &ksym, 0);
+
+                    switch (ksym) {
+                        case XK_Return:
+                        case XK_KP_Enter:
+                            /* keys typed while verifying are kept as the next
+                             * attempt, typing after it starts a new one */
+                            if (state == STATE_VERIFYING)
+                                auth_queue(len);
+                            else {
+                                auth_submit(password, len);
+                                enter_state(&state, STATE_VERIFYING, timer_fd);
+                            }
+                            len = 0;
+                            break;
+                        case XK_Escape:
+                            len = 0;
+                            clear_password_memory();
+                            /* a running attempt can't be cancelled, only the typeahead */
+                            if (state != STATE_VERIFYING)
+                                enter_state(&state, STATE_SLEEP, timer_fd);
+                            break;
+                        case XK_BackSpace:
+                            if (len)
+                                --len;
+                            break;
+                        default:
+                            if (isprint(inputChar) && (len + sizeof(inputChar) < sizeof password)) {
+                                memcpy(password + len, &inputChar, sizeof(inputChar));
+                                len += sizeof(inputChar);
+                            }
+                            break;
+                    }
+                    break;
+                }
 
-            /* draw new passdisp or 'auth failed' */
-            if (failed) {
-                x = base_x - XTextWidth(font, "authentication failed", 21) / 2;
-                XSetForeground(dpy, gc, red.pixel);
-                XDrawString(dpy, bb, gc, x, base_y + ascent + 20, "authentication failed", 21);
-                XSetForeground(dpy, gc, white.pixel);
+                default:
+                    /* the server is done reading an animation frame */
+                    if (event.type == shm_completion)
+                        effect_release();
+                    /* a monitor was plugged in, unplugged or reconfigured;
+                     * several events come at once, they are handled together */
+                    else if (rr_event_base >= 0 && (event.type == rr_event_base + RRScreenChangeNotify ||
+                                                    event.type == rr_event_base + RRNotify)) {
+                        XRRUpdateConfiguration(&event);
+                        outputs_dirty = True;
+                    }
+                    break;
+            }
+        }
+        if (!running)
+            break;
+
+        if (outputs_dirty) {
+            outputs_changed(ctx);
+            outputs_dirty = False;
+        }
+        /* the worker wakes the loop once it has stopped */
+        if (relayout.pending && effect_done()) {
+            outputs_apply(ctx);
+            redraw = True;
+        }
+
+        /* update window once no events are pending */
+        if (redraw && state != STATE_SLEEP) {
+            uint64_t t = trace_now();
+
+            /* the text is drawn over a new frame of the effect before the
+             * swap, so there is no flicker */
+            effect_finish();
+
+            /* new passdisp, 'verifying' or 'auth failed' */
+            const char *status = passdisp;
+            int status_len;
+            if (state == STATE_VERIFYING) {
+                status = "verifying...";
+                status_len = 12;
+            } else if (state == STATE_FAILED) {
+                status = "authentication failed";
+                status_len = 21;
             } else {
                 int lendisp = len;
                 if (hidelength && len > 0)
                     lendisp += (passdisp[len] * len) % 5;
-                x = base_x - XTextWidth(font, passdisp, lendisp) / 2;
-                XDrawString(dpy, bb, gc, x, base_y + ascent + 20, passdisp, lendisp % 256);
+                status_len = lendisp % 256;
+            }
+
+            /* every panel shows the same text, it is measured once */
+            int user_len = strlen(username);
+            int user_width = XTextWidth(font, username, user_len);
+            int status_width = XTextWidth(font, status, status_len);
+
+            // draw backdrops, username and separator
+            XSetForeground(dpy, gc, white.pixel);
+            for (int i = 0; i < npanels; i++) {
+                Panel *p = &panels[i];
+                XCopyArea(dpy, p->backdrop, bb, gc, 0, 0, p->bd_width, p->bd_height, p->bd_x, p->bd_y);
+                XDrawString(dpy, bb, gc, p->base_x - user_width / 2, p->base_y - 10, username, user_len);
+                XDrawLine(dpy, bb, gc, p->base_x - p->line_width / 2, p->base_y,
+                          p->base_x + p->line_width / 2, p->base_y);
             }
 
+            if (state == STATE_FAILED)
+                XSetForeground(dpy, gc, red.pixel);
+            for (int i = 0; i < npanels; i++) {
+                Panel *p = &panels[i];
+                XDrawString(dpy, bb, gc, p->base_x - status_width / 2, p->base_y + ascent + 20, status, status_len);
+            }
+            XSetForeground(dpy, gc, white.pixel);
+
             if (!XdbeSwapBuffers(dpy, &swapInfo, 1)) {
                 fprintf(stderr, "swap buffers failed!\n");
-                return;
+                break;
             }
+            redraw = False;
+            trace_span("frame", t);
         }
+        XFlush(dpy);
 
-        if (event.type == MotionNotify) {
-            sleepmode = False;
-            failed = False;
-        }
+        /* round trips above, e.g. in outputs_apply(), may have read events
+         * into Xlib's queue; the connection won't wake epoll for them */
+        if (XEventsQueued(dpy, QueuedAlready) > 0)
+            continue;
 
-        if (event.type == KeyPress) {
-            sleepmode = False;
-            failed = False;
+        struct epoll_event events[6];
+        int n = epoll_wait(epfd, events, 6, -1);
+        if (n < 0 && errno != EINTR)
+            die("epoll_wait: %s\n", strerror(errno));
 
-            char inputChar = 0;
-            XLookupString(&event.xkey, &inputChar, sizeof(inputChar), &ksym, 0);
+        for (int i = 0; i < n; i++) {
+            switch (events[i].data.u32) {
+                case SOURCE_X:
+                    /* read by XPending() above */
+                    break;
 
-            switch (ksym) {
-                case XK_Return:
-                case XK_KP_Enter:
-                    password[len] = 0;
-                    if (pam_authenticate(pam_handle, 0) == PAM_SUCCESS) {
-                        clear_password_memory();
+                case SOURCE_TIMER: {
+                    uint64_t expirations;
+                    if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                        break;
+                    if (state == STATE_FAILED) {
+                        enter_state(&state, STATE_INPUT, timer_fd);
+                        redraw = True;
+                    } else if (state == STATE_SLEEP && using_dpms) {
+                        DPMSForceLevel(dpy, DPMSModeOff);
+                    }
+                    break;
+                }
+
+                case SOURCE_SIGNAL: {
+                    struct signalfd_siginfo si;
+                    /* USR1 asks the daemon to lock, which it already is */
+                    if (read(signal_fd, &si, sizeof(si)) == sizeof(si) && si.ssi_signo != SIGUSR1) {
+                        caught_signal = si.ssi_signo;
                         running = False;
-                    } else {
-                        failed = True;
                     }
-                    len = 0;
                     break;
-                case XK_Escape:
-                    len = 0;
-                    sleepmode = True;
+                }
+
+                case SOURCE_TRIGGER:
+                    trigger_accept(True);
                     break;
-                case XK_BackSpace:
-                    if (len)
-                        --len;
+
+                case SOURCE_EFFECT:
+                    /* picked up by the redraw, so animation frames pause
+                     * while the monitors are off */
+                    wakeup_drain(effect_job.fd[0]);
+                    redraw = True;
                     break;
-                default:
-                    if (isprint(inputChar) && (len + sizeof(inputChar) < sizeof password)) {
-                        memcpy(password + len, &inputChar, sizeof(inputChar));
-                        len += sizeof(inputChar);
+
+                case SOURCE_AUTH:
+                    redraw = True;
+                    if (auth_result() == PAM_SUCCESS) {
+                        clear_password_memory();
+                        running = False;
+                    } else if (nqueued > 0) {
+                        /* Return was pressed again while verifying */
+                        auth_submit_queued();
+                    } else {
+                        enter_state(&state, STATE_FAILED, timer_fd);
                     }
                     break;
             }
         }
     }
+
+    close(timer_fd);
+    close(epfd);
 }
 
 Bool
@@ -298,12 +1279,18 @@ parse_options(int argc, char** argv)
         { "passchar",       required_argument, 0, 'p' },
         { "username",       required_argument, 0, 'u' },
         { "hidelength",     no_argument,       0, 'l' },
+        { "threads",        required_argument, 0, 'j' },
+        { "daemon",         no_argument,       0, 'd' },
+        { "trigger",        no_argument,       0, 't' },
+        { "trace",          required_argument, 0, 'T' },
+        { "seed",           required_argument, 0, 's' },
+        { "animate",        required_argument, 0, 'a' },
         { "version",        no_argument,       0, 'v' },
         { 0, 0, 0, 0 },
     };
 
     for (;;) {
-        int opt = getopt_long(argc, argv, "1f:hp:u:vl", opts, NULL);
+        int opt = getopt_long(argc, argv, "1f:hp:u:vlj:dtT:s:a:", opts, NULL);
         if (opt == -1)
             break;
 
@@ -323,6 +1310,12 @@ parse_options(int argc, char** argv)
                     "   -p passchars: characters used to obfuscate the password\n"
                     "   -f font: X logical font description\n"
                     "   -u username: user name to show\n"
+                    "   -j threads: threads used for the effect (default: one per CPU)\n"
+                    "   -d: stay resident and lock on SIGUSR1 or when triggered with -t\n"
+                    "   -t: make the running daemon lock, return once the screen is covered\n"
+                    "   -T file: write a Chrome trace of startup phases and frames to file\n"
+                    "   -s seed: draw the same effect on every lock\n"
+                    "   -a fps: keep the effect moving at up to fps frames per second\n"
                 );
                 break;
             case 'p':
@@ -334,6 +1327,25 @@ parse_options(int argc, char** argv)
             case 'l':
                 opt_hidelength = True;
                 break;
+            case 'j':
+                opt_threads = atoi(optarg);
+                break;
+            case 'd':
+                opt_daemon = True;
+                break;
+            case 't':
+                opt_trigger = True;
+                break;
+            case 'T':
+                opt_trace = optarg;
+                break;
+            case 's':
+                opt_seeded = True;
+                opt_seed = strtoul(optarg, NULL, 0);
+                break;
+            case 'a':
+                opt_fps = atoi(optarg);
+                break;
             case 'v':
                 die(PROGNAME"-"VERSION", © 2013 Jakub Klinkovský\n");
                 break;
@@ -345,184 +1357,465 @@ parse_options(int argc, char** argv)
     return True;
 }
 
-// NOTE(ktravis): the following have been ported from https://github.com/r00tman/corrupter
-// it's not 100% correct or the same yet, but it's close
-
-// force x to stay in [0, b) range. x is assumed to be in [-b,2*b) range
-int wrap(int x, int b) {
-    if (x < 0) {
-        return x + b;
+/* Fills info from the current RandR configuration. Returns False, and leaves
+ * info as it was, if no output is connected. */
+static Bool
+query_outputs(LockContext *ctx) {
+    WindowPositionInfo *info = &ctx->info;
+    XRRScreenResources* screen = NULL;
+    RROutput output;
+    XRROutputInfo* output_info = NULL;
+    XRRCrtcInfo* crtc_info = NULL;
+
+    /* the current configuration is all we need, don't make the server
+     * probe the outputs again */
+    screen = XRRGetScreenResourcesCurrent(dpy, ctx->root);
+    if (!screen || screen->noutput == 0) {
+        if (screen)
+            XRRFreeScreenResources(screen);
+        return False;
     }
-    if (x >= b) {
-        return x - b;
+    output = XRRGetOutputPrimary(dpy, ctx->root);
+
+    /* When there is no primary output, the return value of XRRGetOutputPrimary
+     * is undocumented, probably it is 0. Fall back to the first output in this
+     * case, connected state will be checked later.
+     */
+    if (output == 0) {
+        output = screen->outputs[0];
+    }
+    output_info = XRRGetOutputInfo(dpy, screen, output);
+
+    /* Iterate through screen->outputs until connected output is found. */
+    int i = 0;
+    while (!output_info || output_info->connection != RR_Connected || output_info->crtc == 0) {
+        if (output_info)
+            XRRFreeOutputInfo(output_info);
+        output_info = NULL;
+        if (i == screen->noutput) {
+            XRRFreeScreenResources(screen);
+            return False;
+        }
+        output_info = XRRGetOutputInfo(dpy, screen, screen->outputs[i++]);
+        if (output_info)
+            fprintf(stderr, "Warning: no primary output detected, trying %s.\n", output_info->name);
     }
-    return x;
-}
 
-#define NUM_RAND_FLOATS 15000000
-float rnjesus[NUM_RAND_FLOATS];
+    crtc_info = XRRGetCrtcInfo (dpy, screen, output_info->crtc);
+
+    info->output_x = crtc_info->x;
+    info->output_y = crtc_info->y;
+    info->output_width = crtc_info->width;
+    info->output_height = crtc_info->height;
+    info->display_width = DisplayWidth(dpy, ctx->screen_num);
+    info->display_height = DisplayHeight(dpy, ctx->screen_num);
+
+    /* every CRTC that shows something is captured on its own, clones show
+     * the same area and are taken once. A capture must lie within the root. */
+    info->ncrtcs = 0;
+    for (i = 0; i < screen->ncrtc && info->ncrtcs < MAX_OUTPUTS; i++) {
+        XRRCrtcInfo *crtc = XRRGetCrtcInfo(dpy, screen, screen->crtcs[i]);
+        if (!crtc)
+            continue;
+        int x0 = crtc->x > 0 ? crtc->x : 0;
+        int y0 = crtc->y > 0 ? crtc->y : 0;
+        int x1 = crtc->x + (int)crtc->width < info->display_width ? crtc->x + (int)crtc->width : info->display_width;
+        int y1 = crtc->y + (int)crtc->height < info->display_height ? crtc->y + (int)crtc->height : info->display_height;
+        if (crtc->mode != None && crtc->noutput > 0 && x0 < x1 && y0 < y1) {
+            XRectangle r = { x0, y0, x1 - x0, y1 - y0 };
+            int j = 0;
+            while (j < info->ncrtcs && memcmp(&info->crtcs[j], &r, sizeof(r)) != 0)
+                j++;
+            if (j == info->ncrtcs)
+                info->crtcs[info->ncrtcs++] = r;
+        }
+        XRRFreeCrtcInfo(crtc);
+    }
 
-static inline float nrandf() {
-    static int start = 0;
-    start = (start+1) % NUM_RAND_FLOATS;
-    return rnjesus[start];
+    XRRFreeScreenResources(screen);
+    XRRFreeOutputInfo(output_info);
+    XRRFreeCrtcInfo(crtc_info);
+    return True;
 }
 
-static void rand_init() {
-    srand(0);
-    r4_nor_setup();
-    for (int i = 0; i < NUM_RAND_FLOATS; i++) {
-        rnjesus[i] = r4_nor_value();
+/* Every monitor is captured and corrupted on its own, so the parts of the
+ * root that no monitor shows cost neither memory nor time. With -1 only the
+ * primary one is. Returns the number of rects. */
+static int
+capture_rects(const WindowPositionInfo *info, XRectangle rects[MAX_OUTPUTS]) {
+    if (opt_primary || info->ncrtcs == 0) {
+        rects[0] = (XRectangle){ info->output_x, info->output_y, info->output_width, info->output_height };
+        return 1;
     }
+    memcpy(rects, info->crtcs, info->ncrtcs * sizeof(XRectangle));
+    return info->ncrtcs;
 }
 
-// get normally distributed (rounded to int) value with the specified std. dev.
-int offset(double stddev) {
-    return (int)(nrandf() * stddev);
+/* Puts a panel in the middle of every output. */
+static void
+panels_layout(const WindowPositionInfo *info) {
+    XRectangle primary = { info->output_x, info->output_y, info->output_width, info->output_height };
+    const XRectangle *rects = info->ncrtcs > 0 ? info->crtcs : &primary;
+
+    npanels = info->ncrtcs > 0 ? info->ncrtcs : 1;
+    for (int i = 0; i < npanels; i++) {
+        Panel *p = &panels[i];
+        const XRectangle *r = &rects[i];
+
+        p->base_x = r->x + r->width / 2;
+        p->base_y = r->y + r->height / 2;
+        p->line_width = r->width / 4 < 800 ? r->width / 4 : 800;
+        p->bd_width = r->width / 4 < 1000 ? r->width / 4 : 1000;
+        p->bd_height = 400;
+        p->bd_x = p->base_x - p->bd_width / 2;
+        p->bd_y = p->base_y - p->bd_height / 2;
+    }
 }
 
-// brighten the color safely, i.e., by simultaneously reducing contrast
-uint8_t brighten(uint8_t r, uint8_t add) {
-    uint32_t r32 = (uint32_t)(r);
-    uint32_t add32 = (uint32_t)(add);
-    return (uint8_t)(r32 - r32*add32/255 + add32);
+/* Fills a capture with what the old captures showed before the effect, and
+ * with black where none of them did. */
+static void
+capture_fill(Capture *cap, const Capture *old, int nold) {
+    int w = cap->img->width, h = cap->img->height;
+    uint32_t *data = (uint32_t*)cap->img->data;
+
+    memset(data, 0, 4 * (size_t)w * h);
+    for (int j = 0; j < nold; j++) {
+        const Capture *o = &old[j];
+        if (!o->img)
+            continue;
+        /* the worker hadn't taken it yet */
+        const uint32_t *src = o->state == CAPTURE_GRABBED ? (const uint32_t*)o->img->data : o->raw;
+        int x0 = cap->x > o->x ? cap->x : o->x;
+        int y0 = cap->y > o->y ? cap->y : o->y;
+        int x1 = cap->x + w < o->x + o->img->width ? cap->x + w : o->x + o->img->width;
+        int y1 = cap->y + h < o->y + o->img->height ? cap->y + h : o->y + o->img->height;
+        if (!src || x0 >= x1)
+            continue;
+        for (int y = y0; y < y1; y++)
+            memcpy(data + (size_t)(y - cap->y) * w + (x0 - cap->x),
+                   src + (size_t)(y - o->y) * o->img->width + (x0 - o->x), 4 * (size_t)(x1 - x0));
+    }
 }
 
-void corrupt_it(DATA32 *data, int w, int h) {
-    rand_init();
+/*
+ * Follows a change of the monitors while locked. The worker may be in the
+ * middle of a long run, so it is only asked to stop; the main loop goes on
+ * and calls outputs_apply() once it has.
+ */
+static void
+outputs_changed(LockContext *ctx) {
+    WindowPositionInfo *info = &ctx->info;
+    int old_width = info->display_width, old_height = info->display_height;
+    XRectangle rects[MAX_OUTPUTS];
 
-    double mag = 7.0;
-    int bheight = 10;
-    double boffset = 30.0;
-    double stride_mag = 0.1;
-    double lag = 0.005;
-    double lr = -7.0;
-    double lg = 0.0;
-    double lb = 3.0;
-    double std_offset = 10.0;
-    uint8_t add = 37;
-    int meanabber = 10;
-    double stdabber = 10.0;
+    /* e.g. while every monitor is unplugged, the old layout is kept */
+    if (!query_outputs(ctx))
+        return;
+    /* a change that is already waiting is applied with the latest layout */
+    if (relayout.pending)
+        return;
+    int n = capture_rects(info, rects);
 
-    int line_off = 0;
-    double stride = 0.0;
-    int yset = 0;
+    Bool same = n == ctx->ncaps && info->display_width == old_width && info->display_height == old_height;
+    for (int i = 0; same && i < n; i++) {
+        Capture *c = &ctx->caps[i];
+        same = c->x == rects[i].x && c->y == rects[i].y &&
+               c->img->width == rects[i].width && c->img->height == rects[i].height;
+    }
+    if (same)
+        return;
 
-    int m_raw_stride = 4*w;
+    relayout.pending = True;
+    relayout.width = old_width;
+    relayout.height = old_height;
+    effect_cancel();
+}
 
-    uint8_t *real_src = (uint8_t*)data;
+/*
+ * Applies the change of the monitors once the worker has stopped. The cover
+ * is resized to the new root, and only the monitors whose CRTC changed are
+ * corrupted again, the others keep their frame. The desktop can't be read
+ * under the cover, so a changed monitor starts from the raw captures: the
+ * old desktop where it overlaps one, black where nothing was shown.
+ */
+static void
+outputs_apply(LockContext *ctx) {
+    WindowPositionInfo *info = &ctx->info;
+    int old_width = relayout.width, old_height = relayout.height;
+    int depth = DefaultDepth(dpy, ctx->screen_num);
+    XRectangle rects[MAX_OUTPUTS];
+    uint64_t t = trace_now();
+
+    relayout.pending = False;
+    int n = capture_rects(info, rects);
+
+    /* take the captures back from the worker, with the frame it had ready;
+     * once the server has read them, pending completions are stale */
+    effect_stop();
+    effect_finish();
+    XSync(dpy, False);
+    XEvent ev;
+    while (shm_completion >= 0 && XCheckTypedEvent(dpy, shm_completion, &ev))
+        ;
+    effect_job.uploads = 0;
+
+    /* the background keeps what it showed, new parts are black */
+    if (info->display_width != old_width || info->display_height != old_height) {
+        XResizeWindow(dpy, ctx->w, info->display_width, info->display_height);
+        Pixmap pix = XCreatePixmap(dpy, ctx->w, info->display_width, info->display_height, depth);
+        XSetForeground(dpy, ctx->gc, ctx->black.pixel);
+        XFillRectangle(dpy, pix, ctx->gc, 0, 0, info->display_width, info->display_height);
+        XSetForeground(dpy, ctx->gc, ctx->white.pixel);
+        XCopyArea(dpy, bg_pix, pix, ctx->gc, 0, 0, old_width, old_height, 0, 0);
+        XFreePixmap(dpy, bg_pix);
+        bg_pix = pix;
+        XSetWindowBackgroundPixmap(dpy, ctx->w, bg_pix);
+    }
 
-    uint8_t *buf1 = malloc(4*w*h);
-    uint8_t *buf2 = malloc(4*w*h);
+    /* a monitor whose CRTC is unchanged keeps its capture, wherever it is
+     * in the list now */
+    Capture old[MAX_OUTPUTS];
+    Bool kept[MAX_OUTPUTS] = { False };
+    Bool todo = False;
+    memcpy(old, ctx->caps, sizeof(old));
+    memset(ctx->caps, 0, sizeof(ctx->caps));
+    for (int i = 0; i < n; i++) {
+        int j = 0;
+        while (j < ctx->ncaps && (kept[j] || !(old[j].img && old[j].x == rects[i].x && old[j].y == rects[i].y &&
+                                               old[j].img->width == rects[i].width && old[j].img->height == rects[i].height)))
+            j++;
+        if (j < ctx->ncaps) {
+            ctx->caps[i] = old[j];
+            kept[j] = True;
+            continue;
+        }
+        capture_create(&ctx->caps[i], DefaultVisual(dpy, ctx->screen_num), depth, rects[i].width, rects[i].height);
+        ctx->caps[i].x = rects[i].x;
+        ctx->caps[i].y = rects[i].y;
+        capture_fill(&ctx->caps[i], old, ctx->ncaps);
+        ctx->caps[i].state = CAPTURE_GRABBED;
+    }
+    for (int j = 0; j < MAX_OUTPUTS; j++) {
+        if (!kept[j])
+            capture_destroy(&old[j]);
+    }
+    ctx->ncaps = n;
+    /* also those the worker stopped before it took them */
+    for (int i = 0; i < n; i++)
+        todo = todo || ctx->caps[i].state == CAPTURE_GRABBED;
+
+    /* the panels follow the monitors */
+    for (int i = 0; i < npanels; i++) {
+        XFreePixmap(dpy, panels[i].backdrop);
+        panels[i].backdrop = None;
+    }
+    panels_layout(info);
+    backdrops_update(ctx, 0, 0, info->display_width, info->display_height, False);
+    XCopyArea(dpy, bg_pix, bb, ctx->gc, 0, 0, info->display_width, info->display_height, 0, 0);
+
+    /* the worker also goes on animating the monitors that were kept */
+    if (todo || opt_fps > 0) {
+        effect_start(ctx, opt_seeded ? (uint32_t)opt_seed : (uint32_t)rand());
+        effect_captured();
+    }
+    trace_span("outputs changed", t);
+}
 
-    uint8_t *src = real_src;
-    uint8_t *dst = buf1;
+/* Captures and corrupts the screen, locks it and runs the main loop until
+ * the user authenticates. Returns False if the grabs failed. */
+static Bool
+lock_screen(LockContext *ctx) {
+    WindowPositionInfo *info = &ctx->info;
+    Window w = ctx->w;
+    int depth = DefaultDepth(dpy, ctx->screen_num);
+
+    uint64_t t_lock = trace_now(), t;
+
+    /* the outputs may have changed since the daemon started */
+    if (opt_daemon) {
+        int old_width = info->display_width, old_height = info->display_height;
+        t = trace_now();
+        query_outputs(ctx);
+        trace_span("randr", t);
+        if (info->display_width != old_width || info->display_height != old_height)
+            XResizeWindow(dpy, w, info->display_width, info->display_height);
+    }
 
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
-			// Every BHEIGHT lines in average a new distorted block begins
-			if ((rand() % (bheight*w)) == 0) {
-				line_off = offset(boffset);
-				stride = stride_mag*nrandf();
-				yset = y;
-			}
-			// at the line where the block has begun, we don't want to offset the image
-			// so stride_off is 0 on the block's line
-			int stride_off = (int)(stride * (double)(y-yset));
+    /* Startup is staged so that the screen is secured in a fixed amount of
+     * time, however large it is and however long the effect takes: first
+     * grab the input, then capture the screen and cover it with the dimmed
+     * capture. The effect is computed in the background and swapped in by
+     * the main loop. The window can't be mapped before the capture, as it
+     * would end up in it. */
 
-			// offset is composed of the blur, block offset, and skew offset (stride)
-			int offx = offset(mag) + line_off + stride_off;
-			int offy = offset(mag);
+    /* grab pointer and keyboard */
+    t = trace_now();
+    int len = 1000;
+    while (len-- > 0) {
+        if (XGrabPointer(dpy, ctx->root, False, ButtonPressMask | ButtonReleaseMask | PointerMotionMask,
+                    GrabModeAsync, GrabModeAsync, None, ctx->invisible, CurrentTime) == GrabSuccess)
+            break;
+        usleep(50);
+    }
+    while (len-- > 0) {
+        if (XGrabKeyboard(dpy, ctx->root, True, GrabModeAsync, GrabModeAsync, CurrentTime) == GrabSuccess)
+            break;
+        usleep(50);
+    }
+    trace_span("grab", t);
+    if (len <= 0) {
+        XUngrabPointer(dpy, CurrentTime);
+        return False;
+    }
 
-			// copy the corresponding pixel (4 bytes) to the new image
-			int src_idx = m_raw_stride*wrap(y+offy, h) + 4*wrap(x+offx, w);
-			int dst_idx = m_raw_stride*y + 4*x;
+    XRectangle rects[MAX_OUTPUTS];
+    int ncaps = capture_rects(info, rects);
+
+    /* the root window has the default visual, not necessarily the Xdbe one */
+    t = trace_now();
+    for (int i = 0; i < MAX_OUTPUTS; i++) {
+        Capture *cap = &ctx->caps[i];
+        if (i >= ncaps)
+            capture_destroy(cap);
+        else if (!cap->img || cap->img->width != rects[i].width || cap->img->height != rects[i].height) {
+            capture_destroy(cap);
+            capture_create(cap, DefaultVisual(dpy, ctx->screen_num), depth, rects[i].width, rects[i].height);
+        }
+        /* the worker picks the captures to corrupt when it starts, those
+         * kept from the last lock were shown already */
+        if (i < ncaps)
+            cap->state = CAPTURE_GRABBED;
+    }
+    ctx->ncaps = ncaps;
+    effect_start(ctx, opt_seeded ? (uint32_t)opt_seed : (uint32_t)rand());
+    for (int i = 0; i < ncaps; i++)
+        capture_grab(&ctx->caps[i], ctx->root, rects[i].x, rects[i].y);
+    XSync(dpy, False);
+    trace_span("capture", t);
 
-			memcpy(&dst[dst_idx], &src[src_idx], 4);
-		}
-	}
+    panels_layout(info);
 
-    src = dst;
-    dst = buf2;
+    /* cover the screen with the dimmed capture until the effect is ready */
+    t = trace_now();
+    for (int i = 0; i < ncaps; i++)
+        show_frame(ctx, &ctx->caps[i], 0, ctx->caps[i].img->height, True, False);
+    XMapRaised(dpy, w);
+    XSync(dpy, False);
+    trigger_notify(True);
+    trace_span("cover", t);
+    trace_span("time to cover", t_lock);
 
-	// second stage is adding per-channel scan inconsistency and brightening
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
-            lr += lag * nrandf();
-            lg += lag * nrandf();
-            lb += lag * nrandf();
-            int offx = offset(std_offset);
+    effect_captured();
+    trace_span("lock", t_lock);
 
-            // obtain source pixel base offsets. red/blue border is also smoothed by offx
-            int ra_idx = m_raw_stride*y + 4*wrap(x+(int)(lr)-offx, w);
-            int g_idx  = m_raw_stride*y + 4*wrap(x+(int)(lg), w);
-            int b_idx  = m_raw_stride*y + 4*wrap(x+(int)(lb)+offx, w);
+    /* handle dpms */
+    using_dpms = DPMSCapable(dpy);
+    if (using_dpms) {
+        /* save dpms timeouts to restore on exit */
+        DPMSGetTimeouts(dpy, &dpms_original.standby, &dpms_original.suspend, &dpms_original.off);
+        DPMSInfo(dpy, &dpms_original.level, &dpms_original.state);
 
-            // pixels are stored in (b, g, r, a) order in memory
-            uint8_t b = src[b_idx+0];
-            uint8_t g = src[g_idx+1];
-            uint8_t r = src[ra_idx+2];
-            uint8_t a = src[ra_idx+3];
-
-            b = brighten(b, add);
-            g = brighten(g, add);
-            r = brighten(r, add);
-
-            // copy the corresponding pixel (4 bytes) to the new image
-			int dst_idx = m_raw_stride*y + 4*x;
-
-            dst[dst_idx+0] = b;
-            dst[dst_idx+1] = g;
-            dst[dst_idx+2] = r;
-            dst[dst_idx+3] = a;
-        }
+        /* set program specific dpms timeouts */
+        DPMSSetTimeouts(dpy, dpms_timeout, dpms_timeout, dpms_timeout);
+
+        /* force dpms enabled until exit */
+        DPMSEnable(dpy);
     }
 
-    src = dst;
-    dst = real_src;
+    /* run main loop */
+    main_loop(ctx);
 
-	/*// third stage is to add chromatic abberation+chromatic trails*/
-	/*// (trails happen because we're changing the same image we process)*/
-    for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
-            int offx = meanabber + offset(stdabber); // lower offset arg = longer trails
+    /* unlocked before the effect was done, it can't be cancelled */
+    effect_stop();
 
-            // obtain source pixel base offsets. only red and blue are distorted
-            int ra_idx = m_raw_stride*y + 4*wrap(x+offx, w);
-            int g_idx  = m_raw_stride*y + 4*x;
-            int b_idx  = m_raw_stride*y + 4*wrap(x-offx, w);
+    /* restore dpms settings */
+    if (using_dpms) {
+        DPMSSetTimeouts(dpy, dpms_original.standby, dpms_original.suspend, dpms_original.off);
+        if (!dpms_original.state)
+            DPMSDisable(dpy);
+    }
 
-            // pixels are stored in (b, g, r, a) order in memory
-            uint8_t b = src[b_idx+0];
-            uint8_t g = src[g_idx+1];
-            uint8_t r = src[ra_idx+2];
-            uint8_t a = src[ra_idx+3];
+    XUngrabKeyboard(dpy, CurrentTime);
+    XUngrabPointer(dpy, CurrentTime);
+    XUnmapWindow(dpy, w);
+    XFreePixmap(dpy, bg_pix);
+    bg_pix = None;
+    /* a change of the monitors still waiting for the worker is picked up by
+     * the next lock, which captures them anyway */
+    if (relayout.pending)
+        XResizeWindow(dpy, w, info->display_width, info->display_height);
+    relayout.pending = False;
+    for (int i = 0; i < npanels; i++) {
+        XFreePixmap(dpy, panels[i].backdrop);
+        panels[i].backdrop = None;
+    }
+    XSync(dpy, False);
+    return True;
+}
 
-            // copy the corresponding pixel (4 bytes) to the SAME image. this gets us nice colorful trails
-            int dst_idx = m_raw_stride*y + 4*x;
+/* Daemon mode: waits for SIGUSR1 or a trigger client and locks. */
+static void
+daemon_run(LockContext *ctx) {
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0)
+        die("epoll_create1: %s\n", strerror(errno));
+    loop_add(epfd, ConnectionNumber(dpy), SOURCE_X);
+    loop_add(epfd, signal_fd, SOURCE_SIGNAL);
+    loop_add(epfd, trigger_fd, SOURCE_TRIGGER);
+
+    while (!caught_signal) {
+        Bool lock = False;
+        XEvent event;
+
+        /* nothing to do with events while unlocked, but keep the queue empty;
+         * Xlib still has to learn about a new root size for the next lock */
+        while (XPending(dpy)) {
+            XNextEvent(dpy, &event);
+            XRRUpdateConfiguration(&event);
+        }
+        XFlush(dpy);
+
+        struct epoll_event events[3];
+        int n = epoll_wait(epfd, events, 3, -1);
+        if (n < 0 && errno != EINTR)
+            die("epoll_wait: %s\n", strerror(errno));
+
+        for (int i = 0; i < n; i++) {
+            switch (events[i].data.u32) {
+                case SOURCE_SIGNAL: {
+                    struct signalfd_siginfo si;
+                    if (read(signal_fd, &si, sizeof(si)) != sizeof(si))
+                        break;
+                    if (si.ssi_signo == SIGUSR1)
+                        lock = True;
+                    else
+                        caught_signal = si.ssi_signo;
+                    break;
+                }
+                case SOURCE_TRIGGER:
+                    trigger_accept(False);
+                    lock = True;
+                    break;
+            }
+        }
 
-            dst[dst_idx+0] = b;
-            dst[dst_idx+1] = g;
-            dst[dst_idx+2] = r;
-            dst[dst_idx+3] = a;
+        if (lock && !caught_signal && !lock_screen(ctx)) {
+            fprintf(stderr, "Cannot grab pointer/keyboard\n");
+            trigger_notify(False);
         }
+        /* the daemon runs for days, every lock is written as it ends */
+        if (lock)
+            trace_flush();
     }
 
+    close(epfd);
 }
 
-// -- end ported section
-
 int
 main(int argc, char** argv) {
-    char passdisp[256];
-    int screen_num;
-    WindowPositionInfo info;
-
-    Cursor invisible;
-    Window root, w;
-    XColor black, red, white;
-    XFontStruct* font;
-    GC gc;
+    LockContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
 
     /* get username (used for PAM authentication) */
     char* username;
@@ -538,87 +1831,72 @@ main(int argc, char** argv) {
     if (!parse_options(argc, argv))
         exit(EXIT_FAILURE);
 
-    /* register signal handler function */
-    if (signal (SIGINT, handle_signal) == SIG_IGN)
-        signal (SIGINT, SIG_IGN);
-    if (signal (SIGHUP, handle_signal) == SIG_IGN)
-        signal (SIGHUP, SIG_IGN);
-    if (signal (SIGTERM, handle_signal) == SIG_IGN)
-        signal (SIGTERM, SIG_IGN);
+    if (opt_trigger)
+        return trigger_lock();
+
+    if (opt_trace)
+        trace_open(opt_trace);
+    uint64_t t_start = trace_now(), t;
+
+    /* block the signals we handle, the main loop reads them from signal_fd;
+     * this happens before any thread is started so they all inherit it */
+    {
+        int sigs[] = { SIGINT, SIGHUP, SIGTERM, SIGUSR1 };
+        int nsigs = sizeof(sigs) / sizeof(sigs[0]) - (opt_daemon ? 0 : 1);
+        sigset_t set;
+        sigemptyset(&set);
+        for (int i = 0; i < nsigs; i++) {
+            struct sigaction sa;
+            /* leave signals alone that we were told to ignore */
+            if (sigaction(sigs[i], NULL, &sa) == 0 && sa.sa_handler == SIG_IGN)
+                continue;
+            sigaddset(&set, sigs[i]);
+        }
+        if (sigprocmask(SIG_BLOCK, &set, NULL) != 0 ||
+            (signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+            die("cannot set up signal handling: %s\n", strerror(errno));
+    }
 
     /* fill with password characters */
-    for (unsigned int i = 0; i < sizeof(passdisp); i += strlen(opt_passchar))
-        for (unsigned int j = 0; j < strlen(opt_passchar) && i + j < sizeof(passdisp); j++)
-            passdisp[i + j] = opt_passchar[j];
+    for (unsigned int i = 0; i < sizeof(ctx.passdisp); i += strlen(opt_passchar))
+        for (unsigned int j = 0; j < strlen(opt_passchar) && i + j < sizeof(ctx.passdisp); j++)
+            ctx.passdisp[i + j] = opt_passchar[j];
 
     /* initialize random number generator */
     srand(time(NULL));
 
+    t = trace_now();
     if (!(dpy = XOpenDisplay(NULL)))
         die("cannot open dpy\n");
+    trace_span("XOpenDisplay", t);
 
-    if (!(font = XLoadQueryFont(dpy, opt_font)))
+    t = trace_now();
+    if (!(ctx.font = XLoadQueryFont(dpy, opt_font)))
         die("error: could not find font. Try using a full description.\n");
+    trace_span("XLoadQueryFont", t);
 
-    screen_num = DefaultScreen(dpy);
-    root = DefaultRootWindow(dpy);
+    ctx.screen_num = DefaultScreen(dpy);
+    ctx.root = DefaultRootWindow(dpy);
 
-    Visual *vis = DefaultVisual(dpy, screen_num);
+    ctx.vis = DefaultVisual(dpy, ctx.screen_num);
     /*int depth = DefaultDepth(dpy, XScreenNumberOfScreen(scr));*/
-    Colormap cm = DefaultColormap(dpy, screen_num);
 
     /* get display/output size and position */
-    {
-        XRRScreenResources* screen = NULL;
-        RROutput output;
-        XRROutputInfo* output_info = NULL;
-        XRRCrtcInfo* crtc_info = NULL;
-
-        screen = XRRGetScreenResources (dpy, root);
-        output = XRRGetOutputPrimary(dpy, root);
-
-        /* When there is no primary output, the return value of XRRGetOutputPrimary
-         * is undocumented, probably it is 0. Fall back to the first output in this
-         * case, connected state will be checked later.
-         */
-        if (output == 0) {
-            output = screen->outputs[0];
-        }
-        output_info = XRRGetOutputInfo(dpy, screen, output);
-
-        /* Iterate through screen->outputs until connected output is found. */
-        int i = 0;
-        while (output_info->connection != RR_Connected || output_info->crtc == 0) {
-            XRRFreeOutputInfo(output_info);
-            output_info = XRRGetOutputInfo(dpy, screen, screen->outputs[i++]);
-            fprintf(stderr, "Warning: no primary output detected, trying %s.\n", output_info->name);
-            if (i == screen->noutput)
-                die("error: no connected output detected.\n");
-        }
-
-        crtc_info = XRRGetCrtcInfo (dpy, screen, output_info->crtc);
-
-        info.output_x = crtc_info->x;
-        info.output_y = crtc_info->y;
-        info.output_width = crtc_info->width;
-        info.output_height = crtc_info->height;
-        info.display_width = DisplayWidth(dpy, screen_num);
-        info.display_height = DisplayHeight(dpy, screen_num);
-
-        XRRFreeScreenResources(screen);
-        XRRFreeOutputInfo(output_info);
-        XRRFreeCrtcInfo(crtc_info);
-    }
+    t = trace_now();
+    if (!query_outputs(&ctx))
+        die("error: no connected output detected.\n");
+    trace_span("randr", t);
 
     /* allocate colors */
     {
         XColor dummy;
-        Colormap cmap = DefaultColormap(dpy, screen_num);
-        XAllocNamedColor(dpy, cmap, "orange red", &red, &dummy);
-        XAllocNamedColor(dpy, cmap, "black", &black, &dummy);
-        XAllocNamedColor(dpy, cmap, "white", &white, &dummy);
+        Colormap cmap = DefaultColormap(dpy, ctx.screen_num);
+        XAllocNamedColor(dpy, cmap, "orange red", &ctx.red, &dummy);
+        XAllocNamedColor(dpy, cmap, "black", &ctx.black, &dummy);
+        XAllocNamedColor(dpy, cmap, "white", &ctx.white, &dummy);
     }
 
+    t = trace_now();
     {
         int major, minor;
         if (!XdbeQueryExtension(dpy, &major, &minor)) {
@@ -626,7 +1904,7 @@ main(int argc, char** argv) {
             return 1;
         }
         int numScreens = 1;
-        Drawable screens[] = { root };
+        Drawable screens[] = { ctx.root };
         XdbeScreenVisualInfo *info = XdbeGetVisualInfo(dpy, screens, &numScreens);
         if (!info || numScreens < 1 || info->count < 1) {
             fprintf(stderr, "created window does not support xdbe ...\n");
@@ -646,37 +1924,41 @@ main(int argc, char** argv) {
             return 1;
         }
 
-        vis = xvisinfo_match->visual;
+        ctx.vis = xvisinfo_match->visual;
     }
+    trace_span("xdbe visual", t);
 
     /* create window */
     {
         XSetWindowAttributes wa;
         wa.override_redirect = 1;
-        wa.background_pixel = black.pixel;
-        w = XCreateWindow(dpy, root, 0, 0, info.display_width, info.display_height,
-                0, DefaultDepth(dpy, screen_num), CopyFromParent,
-                vis, CWOverrideRedirect | CWBackPixel, &wa);
+        wa.background_pixel = ctx.black.pixel;
+        ctx.w = XCreateWindow(dpy, ctx.root, 0, 0, ctx.info.display_width, ctx.info.display_height,
+                0, DefaultDepth(dpy, ctx.screen_num), CopyFromParent,
+                ctx.vis, CWOverrideRedirect | CWBackPixel, &wa);
+
+        bb = XdbeAllocateBackBufferName(dpy, ctx.w, XdbeBackground);
+        XSelectInput(dpy, ctx.w, StructureNotifyMask);
+    }
 
-        bb = XdbeAllocateBackBufferName(dpy, w, XdbeBackground);
-        XSelectInput(dpy, w, StructureNotifyMask);
+    /* follow the monitors while locked */
+    {
+        int error_base;
+        if (XRRQueryExtension(dpy, &rr_event_base, &error_base))
+            XRRSelectInput(dpy, ctx.root, RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask);
+        else
+            rr_event_base = -1;
     }
 
     /* define cursor */
     {
         char curs[] = {0, 0, 0, 0, 0, 0, 0, 0};
-        Pixmap pmap = XCreateBitmapFromData(dpy, w, curs, 8, 8);
-        invisible = XCreatePixmapCursor(dpy, pmap, pmap, &black, &black, 0, 0);
-        XDefineCursor(dpy, w, invisible);
+        Pixmap pmap = XCreateBitmapFromData(dpy, ctx.w, curs, 8, 8);
+        ctx.invisible = XCreatePixmapCursor(dpy, pmap, pmap, &ctx.black, &ctx.black, 0, 0);
+        XDefineCursor(dpy, ctx.w, ctx.invisible);
         XFreePixmap(dpy, pmap);
     }
 
-    /*char *img_data = malloc(ww * hh * 4);*/
-    /*imlib_context_set_image(image);*/
-    /*[>imlib_image_set_has_alpha(1);<]*/
-    /*DATA32 *imagedata = imlib_image_get_data();*/
-    /*memcpy(imagedata, img_data, ww * hh * 4);*/
-
     /*int img_x, img_y, img_n;*/
     /*unsigned char *img_data = stbi_load(img_filename, &img_x, &img_y, &img_n, 4);*/
     /*if (!img_data) {*/
@@ -691,118 +1973,61 @@ main(int argc, char** argv) {
         /*p[2] = x;*/
     /*}*/
 
-    imlib_context_set_display(dpy);
-    imlib_context_set_visual(vis);
-    imlib_context_set_colormap(cm);
-    imlib_context_set_color_modifier(NULL);
-    imlib_context_set_operation(IMLIB_OP_COPY);
-
-    int capture_x = opt_primary ? info.output_x : 0;
-    int capture_y = opt_primary ? info.output_y : 0;
-    int capture_width = opt_primary ? info.output_width : info.display_width;
-    int capture_height = opt_primary ? info.output_height : info.display_height;
-
-    image = gib_imlib_create_image_from_drawable(root, 0, capture_x, capture_y, capture_width, capture_height, 0);
-
-    imlib_context_set_image(image);
-    /*gib_imlib_image_blur(image, 5);*/
-    DATA32 *data = imlib_image_get_data();
-    corrupt_it(data, capture_width, capture_height);
-    imlib_image_put_back_data(data);
-
     /* create Graphics Context */
     {
         XGCValues values;
-        gc = XCreateGC(dpy, w, (unsigned long)0, &values);
-        XSetFont(dpy, gc, font->fid);
-        XSetForeground(dpy, gc, black.pixel);
-
-        Pixmap gbpix = XCreatePixmap(dpy, w, info.display_width, info.display_height, DefaultDepth(dpy, screen_num));
-        XFillRectangle(dpy, gbpix, gc, 0, 0, info.display_width, info.display_height);
-        XSetForeground(dpy, gc, white.pixel);
-        XImage *img = XCreateImage(dpy, vis, 24, ZPixmap, 0, (char*)data, capture_width, capture_height, 32, 0);
-        XPutImage(dpy, gbpix, gc, img, 0, 0, capture_x, capture_y, capture_width, capture_height);
-        XSetWindowBackgroundPixmap(dpy, w, gbpix);
-        XFreePixmap(dpy, gbpix);
-
-        XPutImage(dpy, bb, gc, img, 0, 0, capture_x, capture_y, capture_width, capture_height);
-        XClearArea(dpy, w, info.output_x, info.output_y, info.output_width, info.output_height, False);
-    }
-
-    backdrop_width = info.output_width / 4;
-    if (backdrop_width > 1000)
-        backdrop_width = 1000;
-    backdrop_height = 400;
-    backdrop_x = info.output_x + info.output_width/2 - backdrop_width/2;
-    backdrop_y = info.output_y + info.output_height/2 - backdrop_height/2;
-
-    uint32_t *bd_data = malloc(sizeof(uint32_t) * backdrop_width * backdrop_height);
-    for (int x = 0; x < backdrop_width; x++) {
-        for (int y = 0; y < backdrop_height; y++) {
-            DATA32 p = data[x+backdrop_x + (y+backdrop_y)*capture_width];
-            bd_data[x + y*backdrop_width] = p & 0x00dbdbdb;
-        }
+        /* no NoExpose events for every XCopyArea */
+        values.graphics_exposures = False;
+        ctx.gc = XCreateGC(dpy, ctx.w, GCGraphicsExposures, &values);
+        XSetFont(dpy, ctx.gc, ctx.font->fid);
     }
-    bd_img = XCreateImage(dpy, vis, 24, ZPixmap, 0, (char*)bd_data, backdrop_width, backdrop_height, 32, 0);
 
-    /* grab pointer and keyboard */
-    int len = 1000;
-    while (len-- > 0) {
-        if (XGrabPointer(dpy, root, False, ButtonPressMask | ButtonReleaseMask | PointerMotionMask,
-                    GrabModeAsync, GrabModeAsync, None, invisible, CurrentTime) == GrabSuccess)
-            break;
-        usleep(50);
-    }
-    while (len-- > 0) {
-        if (XGrabKeyboard(dpy, root, True, GrabModeAsync, GrabModeAsync, CurrentTime) == GrabSuccess)
-            break;
-        usleep(50);
-    }
-    if (len <= 0)
-        die("Cannot grab pointer/keyboard\n");
+    t = trace_now();
+    effect_init();
+    ctx.pool = pool_create(opt_threads);
+    trace_span("effect setup", t);
 
     /* set up PAM */
+    t = trace_now();
     {
         int ret = pam_start("sxlock", username, &conv, &pam_handle);
         if (ret != PAM_SUCCESS)
             die("PAM: %s\n", pam_strerror(pam_handle, ret));
     }
+    trace_span("pam_start", t);
 
     /* Lock the area where we store the password in memory, we don’t want it to
      * be swapped to disk. Since Linux 2.6.9, this does not require any
      * privileges, just enough bytes in the RLIMIT_MEMLOCK limit. */
-    if (mlock(password, sizeof(password)) != 0)
+    if (mlock(password, sizeof(password)) != 0 || mlock(auth_password, sizeof(auth_password)) != 0 ||
+        mlock(queued_password, sizeof(queued_password)) != 0)
         die("Could not lock page in memory, check RLIMIT_MEMLOCK\n");
 
-    /* handle dpms */
-    using_dpms = DPMSCapable(dpy);
-    if (using_dpms) {
-        /* save dpms timeouts to restore on exit */
-        DPMSGetTimeouts(dpy, &dpms_original.standby, &dpms_original.suspend, &dpms_original.off);
-        DPMSInfo(dpy, &dpms_original.level, &dpms_original.state);
+    auth_start();
+    trace_span("startup", t_start);
 
-        /* set program specific dpms timeouts */
-        DPMSSetTimeouts(dpy, dpms_timeout, dpms_timeout, dpms_timeout);
+    if (opt_daemon) {
+        trigger_listen();
+        daemon_run(&ctx);
 
-        /* force dpms enabled until exit */
-        DPMSEnable(dpy);
+        struct sockaddr_un addr;
+        socket_path(&addr);
+        unlink(addr.sun_path);
+    } else if (!lock_screen(&ctx)) {
+        die("Cannot grab pointer/keyboard\n");
     }
 
-    /* run main loop */
-    main_loop(w, gc, font, &info, passdisp, opt_username, black, white, red, opt_hidelength);
-
-    /* restore dpms settings */
-    if (using_dpms) {
-        DPMSSetTimeouts(dpy, dpms_original.standby, dpms_original.suspend, dpms_original.off);
-        if (!dpms_original.state)
-            DPMSDisable(dpy);
-    }
+    if (caught_signal)
+        die("Caught signal %d; dying\n", caught_signal);
 
-    XUngrabPointer(dpy, CurrentTime);
-    XFreeFont(dpy, font);
-    XFreeGC(dpy, gc);
-    XDestroyWindow(dpy, w);
+    for (int i = 0; i < MAX_OUTPUTS; i++)
+        capture_destroy(&ctx.caps[i]);
+    pool_destroy(ctx.pool);
+    XFreeFont(dpy, ctx.font);
+    XFreeGC(dpy, ctx.gc);
+    XDestroyWindow(dpy, ctx.w);
     XCloseDisplay(dpy);
     /*stbi_image_free(img_data);*/
+    trace_close();
     return 0;
 }
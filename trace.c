@@ -0,0 +1,168 @@
+/*
+ * MIT/X Consortium License, see LICENSE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>     // getpid()
+#include <pthread.h>
+
+#include "trace.h"
+
+typedef struct TraceEvent {
+    const char *name;
+    uint64_t start, end;
+    pthread_t thread;
+} TraceEvent;
+
+static struct {
+    pthread_mutex_t lock;
+    int enabled;            // only changed while no other thread records
+    char *path;
+    FILE *file;             // open once events are first written
+    size_t written;         // events in the file
+    uint64_t origin;
+    TraceEvent *events;
+    size_t count, size;
+    pthread_t *threads;     // numbered in order of their first event
+    int nthreads, threads_size;
+} trace = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+uint64_t
+trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void
+trace_open(const char *path) {
+    pthread_mutex_lock(&trace.lock);
+    free(trace.path);
+    trace.path = path ? malloc(strlen(path) + 1) : NULL;
+    if (trace.path)
+        strcpy(trace.path, path);
+    trace.origin = trace_now();
+    trace.enabled = trace.path != NULL;
+    pthread_mutex_unlock(&trace.lock);
+}
+
+void
+trace_span(const char *name, uint64_t start) {
+    if (!trace.enabled)
+        return;
+
+    uint64_t end = trace_now();
+
+    pthread_mutex_lock(&trace.lock);
+
+    if (trace.count == trace.size) {
+        size_t size = trace.size ? 2 * trace.size : 1024;
+        TraceEvent *events = realloc(trace.events, size * sizeof(TraceEvent));
+        if (!events)
+            goto out;
+        trace.events = events;
+        trace.size = size;
+    }
+
+    trace.events[trace.count].name = name;
+    trace.events[trace.count].start = start;
+    trace.events[trace.count].end = end;
+    trace.events[trace.count].thread = pthread_self();
+    trace.count++;
+
+out:
+    pthread_mutex_unlock(&trace.lock);
+}
+
+/* the number of the thread, or 0 if it can't be remembered */
+static int
+thread_id(pthread_t thread) {
+    int tid = 0;
+
+    while (tid < trace.nthreads && !pthread_equal(trace.threads[tid], thread))
+        tid++;
+    if (tid < trace.nthreads)
+        return tid + 1;
+
+    if (trace.nthreads == trace.threads_size) {
+        int size = trace.threads_size ? 2 * trace.threads_size : 16;
+        pthread_t *threads = realloc(trace.threads, size * sizeof(pthread_t));
+        if (!threads)
+            return 0;
+        trace.threads = threads;
+        trace.threads_size = size;
+    }
+    trace.threads[trace.nthreads++] = thread;
+    return trace.nthreads;
+}
+
+/* Appends the recorded events to the file and forgets them. Called with the
+ * lock held. */
+static void
+write_events(void) {
+    if (!trace.file) {
+        if (!(trace.file = fopen(trace.path, "w"))) {
+            perror(trace.path);
+            trace.count = 0;
+            return;
+        }
+        fprintf(trace.file, "{\"traceEvents\":[\n");
+    }
+    if (trace.written && trace.count)
+        fprintf(trace.file, ",\n");
+
+    for (size_t i = 0; i < trace.count; i++) {
+        TraceEvent *e = &trace.events[i];
+
+        /* spans may have started before trace_open() */
+        uint64_t start = e->start > trace.origin ? e->start : trace.origin;
+
+        fprintf(trace.file, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":%d,\"tid\":%d}%s",
+                e->name,
+                (unsigned long long)(start - trace.origin),
+                (unsigned long long)(e->end - start),
+                (int)getpid(), thread_id(e->thread),
+                i + 1 < trace.count ? ",\n" : "");
+    }
+    fflush(trace.file);
+    trace.written += trace.count;
+    trace.count = 0;
+}
+
+void
+trace_flush(void) {
+    if (!trace.enabled)
+        return;
+
+    pthread_mutex_lock(&trace.lock);
+    write_events();
+    pthread_mutex_unlock(&trace.lock);
+}
+
+void
+trace_close(void) {
+    pthread_mutex_lock(&trace.lock);
+    if (trace.enabled) {
+        write_events();
+        if (trace.file) {
+            fprintf(trace.file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+            fclose(trace.file);
+            trace.file = NULL;
+            trace.written = 0;
+        }
+    }
+
+    trace.enabled = 0;
+    free(trace.path);
+    trace.path = NULL;
+    free(trace.events);
+    trace.events = NULL;
+    trace.count = trace.size = 0;
+    free(trace.threads);
+    trace.threads = NULL;
+    trace.nthreads = trace.threads_size = 0;
+    pthread_mutex_unlock(&trace.lock);
+}
@@ -0,0 +1,31 @@
+/*
+ * Phase tracing in the Chrome trace event format, for chrome://tracing or
+ * https://ui.perfetto.dev.
+ *
+ *     uint64_t t = trace_now();
+ *     ...
+ *     trace_span("capture", t);
+ *
+ * Nothing is recorded until trace_open() is called; spans may be recorded from
+ * any thread. While tracing is off a span costs a branch. trace_open() and
+ * trace_close() must be called while no other thread records spans.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+void trace_open(const char *path);
+/* writes the events recorded so far to the trace file and forgets them, so a
+ * long running process doesn't keep them all */
+void trace_flush(void);
+/* writes the rest of the trace file, if tracing is enabled */
+void trace_close(void);
+
+/* monotonic time in microseconds */
+uint64_t trace_now(void);
+/* records the span [start, now); name must be a string literal */
+void trace_span(const char *name, uint64_t start);
+
+#endif